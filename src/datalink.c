@@ -2,8 +2,8 @@
 #include "lprintf.h"
 #include "protocol.h"
 // NOLINTBEGIN(cppcoreguidelines-avoid-non-const-global-variables, readability-identifier-length, bugprone-easily-swappable-parameters, readability-function-cognitive-complexity)
-static bool no_nak = true; /* no nak has been sent yet */
-static bool phl_ready = false;
+static STATION_LOCAL bool no_nak = true; /* no nak has been sent yet */
+static STATION_LOCAL bool phl_ready = false;
 
 static bool between(seq_nr a, seq_nr b, seq_nr c)
 {
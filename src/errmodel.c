@@ -0,0 +1,222 @@
+/*
+    Bit-error models of the simulated physical layer
+
+    Errors hit the channel bits of the line, the low 'bits' bits of every
+    line byte (4 for nibble, 8 for COBS), so the achieved rate is errors
+    over channel bits and matches the configured BER.
+
+    BER:   the gap to the next error is drawn from the geometric
+           distribution, so clean bits cost nothing and a block only
+           pays for the bits actually flipped.
+    GE:    Gilbert-Elliott two-state Markov channel. The time spent in
+           a state is geometric too; within a state errors are
+           independent with that state's rate.
+    trace: XOR masks from a file, one per line byte, replayed in a loop.
+*/
+
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "errmodel.h"
+
+#ifdef _WIN32
+#define strncasecmp _strnicmp
+#else
+#include <strings.h>
+#endif
+
+#define EM_NEVER (LLONG_MAX / 4)
+
+/* Failures before the first success of a Bernoulli('p') sequence */
+static long long em_geometric(struct EM_STATE *st, double p)
+{
+    double g;
+
+    if (p <= 0.0)
+        return EM_NEVER;
+    if (p >= 1.0)
+        return 0;
+    g = floor(log(st->uniform()) / log1p(-p));
+    return g < EM_NEVER ? (long long)g : EM_NEVER;
+}
+
+static int em_load(struct EM_CONFIG *cfg, const char *fname)
+{
+    FILE *fp;
+    long len;
+
+    if ((fp = fopen(fname, "rb")) == NULL)
+        return -1;
+    fseek(fp, 0, SEEK_END);
+    len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (len <= 0 || len > INT_MAX || (cfg->mask = (unsigned char *)malloc(len)) == NULL
+        || fread(cfg->mask, 1, len, fp) != (size_t)len) {
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+    cfg->mask_len = (int)len;
+    return 0;
+}
+
+int em_parse(struct EM_CONFIG *cfg, const char *spec)
+{
+    int n;
+
+    if (strcasecmp(spec, "ber") == 0) {
+        cfg->model = cfg->ber > 0.0 ? EM_BER : EM_NONE;
+        return 0;
+    }
+
+    if (strncasecmp(spec, "ge:", 3) == 0) {
+        cfg->e_good = 0.0;
+        n = sscanf(spec + 3, "%lf,%lf,%lf,%lf", &cfg->p, &cfg->r, &cfg->e_bad, &cfg->e_good);
+        if (n < 3 || cfg->p <= 0.0 || cfg->p >= 1.0 || cfg->r <= 0.0 || cfg->r >= 1.0
+            || cfg->e_bad < 0.0 || cfg->e_bad > 1.0 || cfg->e_good < 0.0 || cfg->e_good > 1.0)
+            return -1;
+        cfg->model = EM_GE;
+        return 0;
+    }
+
+    if (strncasecmp(spec, "trace:", 6) == 0) {
+        if (em_load(cfg, spec + 6) < 0)
+            return -1;
+        cfg->model = EM_TRACE;
+        return 0;
+    }
+
+    return -1;
+}
+
+void em_init(struct EM_STATE *st, const struct EM_CONFIG *cfg, double (*uniform)(void))
+{
+    memset(st, 0, sizeof(*st));
+    st->cfg = cfg;
+    st->uniform = uniform;
+    st->skip = -1;
+    if (cfg->model == EM_GE) {
+        /* start in the stationary distribution */
+        st->bad = uniform() <= cfg->p / (cfg->p + cfg->r);
+        st->stay = 1 + em_geometric(st, st->bad ? cfg->r : cfg->p);
+    }
+}
+
+/* Errors drawn bit by bit from geometric gaps, over 'nbits' channel bits */
+static int em_flip_bits(struct EM_STATE *st, unsigned char *line, long long nbits, int bits)
+{
+    const struct EM_CONFIG *cfg = st->cfg;
+    long long pos = 0, end, step;
+    int flips = 0;
+
+    while (pos < nbits) {
+        if (st->skip < 0)
+            st->skip = em_geometric(st, cfg->model == EM_GE ? (st->bad ? cfg->e_bad : cfg->e_good) : cfg->ber);
+
+        end = nbits;
+        if (cfg->model == EM_GE && pos + st->stay < end)
+            end = pos + st->stay;
+
+        if (st->skip < end - pos) {
+            pos += st->skip;
+            line[pos / bits] ^= 1 << (pos % bits);
+            flips++;
+            step = st->skip + 1;
+            pos++;
+            st->skip = -1;
+        } else {
+            step = end - pos;
+            st->skip -= step;
+            pos = end;
+        }
+
+        if (cfg->model == EM_GE && (st->stay -= step) == 0) {
+            st->bad = !st->bad;
+            st->stay = 1 + em_geometric(st, st->bad ? cfg->r : cfg->p);
+            st->skip = -1; /* the new state has its own rate */
+        }
+    }
+    return flips;
+}
+
+int em_apply(struct EM_STATE *st, unsigned char *line, int n, int bits)
+{
+    const struct EM_CONFIG *cfg = st->cfg;
+    unsigned char m, keep = (unsigned char)((1 << bits) - 1);
+    int i, flips = 0;
+
+    st->bits += (unsigned long long)n * bits;
+
+    switch (cfg->model) {
+    case EM_BER:
+    case EM_GE:
+        flips = em_flip_bits(st, line, (long long)n * bits, bits);
+        break;
+
+    case EM_TRACE:
+        for (i = 0; i < n; i++) {
+            m = cfg->mask[(st->pos + i) % cfg->mask_len] & keep;
+            if (m) {
+                line[i] ^= m;
+                for (; m; m &= m - 1)
+                    flips++;
+            }
+        }
+        st->pos += n;
+        break;
+    }
+
+    st->errors += flips;
+    return flips;
+}
+
+void em_set_ber(struct EM_STATE *st, struct EM_CONFIG *cfg, double ber)
+{
+    cfg->ber = ber;
+    cfg->model = ber > 0.0 ? EM_BER : EM_NONE;
+    st->skip = -1; /* the gap drawn at the old rate no longer holds */
+}
+
+double em_expected(const struct EM_CONFIG *cfg, int bits)
+{
+    unsigned char keep = (unsigned char)((1 << bits) - 1), m;
+    long long ones = 0;
+    int i;
+
+    switch (cfg->model) {
+    case EM_BER:
+        return cfg->ber;
+    case EM_GE:
+        return (cfg->p * cfg->e_bad + cfg->r * cfg->e_good) / (cfg->p + cfg->r);
+    case EM_TRACE:
+        for (i = 0; i < cfg->mask_len; i++) {
+            for (m = cfg->mask[i] & keep; m; m &= m - 1)
+                ones++;
+        }
+        return (double)ones / ((double)cfg->mask_len * bits);
+    }
+    return 0.0;
+}
+
+const char *em_describe(const struct EM_CONFIG *cfg, char *buf)
+{
+    switch (cfg->model) {
+    case EM_BER:
+        sprintf(buf, "independent, BER %.1E", cfg->ber);
+        break;
+    case EM_GE:
+        sprintf(buf, "Gilbert-Elliott, p %.1E, r %.1E, BER %.1E bad / %.1E good",
+            cfg->p, cfg->r, cfg->e_bad, cfg->e_good);
+        break;
+    case EM_TRACE:
+        sprintf(buf, "trace, %d-byte mask", cfg->mask_len);
+        break;
+    default:
+        strcpy(buf, "none");
+        break;
+    }
+    return buf;
+}
@@ -0,0 +1,55 @@
+#ifndef __ERRMODEL_H__
+#define __ERRMODEL_H__
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/* Bit-error models of the physical layer */
+#define EM_NONE  0 /* error-free channel */
+#define EM_BER   1 /* independent errors, every bit flips with the same probability */
+#define EM_GE    2 /* Gilbert-Elliott: good and bad states with their own error rates */
+#define EM_TRACE 3 /* error mask read from a file, replayed in a loop */
+
+struct EM_CONFIG {
+    int model;
+    double ber;           /* EM_BER */
+    double p, r;          /* EM_GE: good to bad and bad to good, per bit */
+    double e_good, e_bad; /* EM_GE: bit error rate in each state */
+    unsigned char *mask;  /* EM_TRACE: XOR masks of successive line bytes */
+    int mask_len;
+};
+
+/* Error state of one receiving station */
+struct EM_STATE {
+    const struct EM_CONFIG *cfg;
+    double (*uniform)(void); /* random numbers in (0, 1] */
+    long long skip;          /* clean bits before the next error, -1 to draw */
+    long long stay;          /* EM_GE: bits left in the current state */
+    int bad;                 /* EM_GE: in the bad state */
+    long long pos;           /* EM_TRACE: line bytes seen */
+    unsigned long long bits, errors;
+};
+
+/* Parse "ber", "ge:<p>,<r>,<e_bad>[,<e_good>]" or "trace:<file>", -1 on errors */
+extern int em_parse(struct EM_CONFIG *cfg, const char *spec);
+
+extern void em_init(struct EM_STATE *st, const struct EM_CONFIG *cfg, double (*uniform)(void));
+
+/* Flip bits of 'n' line bytes, each carrying its low 'bits' bits on the channel; return bits flipped */
+extern int em_apply(struct EM_STATE *st, unsigned char *line, int n, int bits);
+
+/* Switch 'cfg', the configuration of 'st', to independent errors at 'ber' (0: none) from the next bit on */
+extern void em_set_ber(struct EM_STATE *st, struct EM_CONFIG *cfg, double ber);
+
+/* Long-run bit error rate the configuration asks for, on 'bits'-bit line bytes */
+extern double em_expected(const struct EM_CONFIG *cfg, int bits);
+
+/* One-line description of the configuration */
+extern const char *em_describe(const struct EM_CONFIG *cfg, char *buf);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,375 @@
+/*
+    Line codes of the simulated physical layer
+
+    nibble: every frame byte goes on the line as two bytes, low nibble
+            first, so 0xff never appears inside a frame and delimits it.
+            Overhead 2x.
+    COBS:   consistent overhead byte stuffing. Zero bytes are removed by
+            splitting the frame into runs of at most 254 non-zero bytes,
+            each led by a code byte, and 0x00 ends the frame.
+            Overhead 1 byte per 254 plus the delimiter.
+
+    The nibble split and merge have SSE2 and AVX2 kernels besides the
+    scalar ones, picked at run time by lc_init().
+*/
+
+#include <string.h>
+
+#include "linecode.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LC_X86
+#include <immintrin.h>
+#define LC_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+#ifdef _WIN32
+#define strcasecmp _stricmp
+#else
+#include <strings.h>
+#endif
+
+static const char *names[] = { "nibble", "cobs" };
+
+const char *lc_name(int code)
+{
+    return code == LINECODE_COBS ? names[1] : names[0];
+}
+
+int lc_lookup(const char *name)
+{
+    int i;
+
+    for (i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++) {
+        if (strcasecmp(name, names[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+unsigned char lc_delimiter(int code)
+{
+    return code == LINECODE_COBS ? 0x00 : 0xff;
+}
+
+int lc_bits(int code)
+{
+    return code == LINECODE_COBS ? 8 : 4;
+}
+
+int lc_bound(int code, int len)
+{
+    if (code == LINECODE_COBS)
+        return len + len / 254 + 2;
+    return len * 2 + 2;
+}
+
+/* Kernels: split 'n' bytes into 2n nibble bytes, merge 'n' byte pairs back */
+
+static void split_scalar(const unsigned char *in, int n, unsigned char *out)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        *out++ = in[i] & 0x0f;
+        *out++ = (in[i] & 0xf0) >> 4;
+    }
+}
+
+static void merge_scalar(const unsigned char *in, int n, unsigned char *out)
+{
+    int i;
+
+    for (i = 0; i < n; i++, in += 2)
+        out[i] = in[0] | (unsigned char)((in[1] << 4) ^ (in[1] & 0xf0));
+}
+
+#ifdef LC_X86
+
+LC_TARGET("sse2")
+static void split_sse2(const unsigned char *in, int n, unsigned char *out)
+{
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    __m128i v, lo, hi;
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16, out += 32) {
+        v = _mm_loadu_si128((const __m128i *)(in + i));
+        lo = _mm_and_si128(v, mask);
+        hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+        _mm_storeu_si128((__m128i *)out, _mm_unpacklo_epi8(lo, hi));
+        _mm_storeu_si128((__m128i *)(out + 16), _mm_unpackhi_epi8(lo, hi));
+    }
+    split_scalar(in + i, n - i, out);
+}
+
+LC_TARGET("sse2")
+static void merge_sse2(const unsigned char *in, int n, unsigned char *out)
+{
+    const __m128i low8 = _mm_set1_epi16(0x00ff), high4 = _mm_set1_epi16(0x00f0);
+    __m128i a, b;
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16, in += 32) {
+        a = _mm_loadu_si128((const __m128i *)in);
+        b = _mm_loadu_si128((const __m128i *)(in + 16));
+        /* per 16-bit lane: low byte carries bits 0-7, high byte the high nibble */
+        a = _mm_or_si128(_mm_and_si128(a, low8),
+            _mm_xor_si128(_mm_and_si128(_mm_srli_epi16(a, 4), high4), _mm_and_si128(_mm_srli_epi16(a, 8), high4)));
+        b = _mm_or_si128(_mm_and_si128(b, low8),
+            _mm_xor_si128(_mm_and_si128(_mm_srli_epi16(b, 4), high4), _mm_and_si128(_mm_srli_epi16(b, 8), high4)));
+        _mm_storeu_si128((__m128i *)(out + i), _mm_packus_epi16(a, b));
+    }
+    merge_scalar(in, n - i, out + i);
+}
+
+LC_TARGET("avx2")
+static void split_avx2(const unsigned char *in, int n, unsigned char *out)
+{
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    __m256i v, lo, hi;
+    int i;
+
+    for (i = 0; i + 32 <= n; i += 32, out += 64) {
+        /* unpack works per 128-bit lane, so pair qwords 0,2 and 1,3 first */
+        v = _mm256_permute4x64_epi64(_mm256_loadu_si256((const __m256i *)(in + i)), 0xd8);
+        lo = _mm256_and_si256(v, mask);
+        hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), mask);
+        _mm256_storeu_si256((__m256i *)out, _mm256_unpacklo_epi8(lo, hi));
+        _mm256_storeu_si256((__m256i *)(out + 32), _mm256_unpackhi_epi8(lo, hi));
+    }
+    split_sse2(in + i, n - i, out);
+}
+
+LC_TARGET("avx2")
+static void merge_avx2(const unsigned char *in, int n, unsigned char *out)
+{
+    const __m256i low8 = _mm256_set1_epi16(0x00ff), high4 = _mm256_set1_epi16(0x00f0);
+    __m256i a, b;
+    int i;
+
+    for (i = 0; i + 32 <= n; i += 32, in += 64) {
+        a = _mm256_loadu_si256((const __m256i *)in);
+        b = _mm256_loadu_si256((const __m256i *)(in + 32));
+        a = _mm256_or_si256(_mm256_and_si256(a, low8),
+            _mm256_xor_si256(_mm256_and_si256(_mm256_srli_epi16(a, 4), high4), _mm256_and_si256(_mm256_srli_epi16(a, 8), high4)));
+        b = _mm256_or_si256(_mm256_and_si256(b, low8),
+            _mm256_xor_si256(_mm256_and_si256(_mm256_srli_epi16(b, 4), high4), _mm256_and_si256(_mm256_srli_epi16(b, 8), high4)));
+        /* packus interleaves the lanes, put the qwords back in order */
+        _mm256_storeu_si256((__m256i *)(out + i), _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xd8));
+    }
+    merge_sse2(in, n - i, out + i);
+}
+
+#endif /* LC_X86 */
+
+static void (*split)(const unsigned char *in, int n, unsigned char *out) = split_scalar;
+static void (*merge)(const unsigned char *in, int n, unsigned char *out) = merge_scalar;
+static const char *kernel = "scalar";
+
+const char *lc_init(void)
+{
+#ifdef LC_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        split = split_avx2;
+        merge = merge_avx2;
+        kernel = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        split = split_sse2;
+        merge = merge_sse2;
+        kernel = "sse2";
+    }
+#endif
+    return kernel;
+}
+
+/* libc memchr() already scans 16-32 bytes per step and beats hand-written kernels */
+int lc_find(int code, const unsigned char *line, int n)
+{
+    const unsigned char *q = (const unsigned char *)memchr(line, lc_delimiter(code), n);
+    return q ? (int)(q - line) : n;
+}
+
+static int nibble_encode(const unsigned char *frame, int len, unsigned char *line)
+{
+    line[0] = 0xff;
+    split(frame, len, line + 1);
+    line[len * 2 + 1] = 0xff;
+
+    return len * 2 + 2;
+}
+
+static int cobs_encode(const unsigned char *frame, int len, unsigned char *line)
+{
+    int i, n = 1, code_pos = 0;
+    unsigned char code = 1;
+
+    for (i = 0; i < len; i++) {
+        if (frame[i] == 0) {
+            line[code_pos] = code;
+            code_pos = n++;
+            code = 1;
+        } else {
+            line[n++] = frame[i];
+            if (++code == 0xff) {
+                line[code_pos] = code;
+                code_pos = n++;
+                code = 1;
+            }
+        }
+    }
+    line[code_pos] = code;
+    line[n++] = 0x00;
+
+    return n;
+}
+
+int lc_encode(int code, const unsigned char *frame, int len, unsigned char *line)
+{
+    if (code == LINECODE_COBS)
+        return cobs_encode(frame, len, line);
+    return nibble_encode(frame, len, line);
+}
+
+static void nibble_decode(struct LC_STATE *st, const unsigned char *line, int n,
+    unsigned char *frame, int size)
+{
+    int pairs;
+
+    if (n > 0 && st->state == 1 && st->len < size) {
+        frame[st->len] |= (*line << 4) ^ (*line & 0xf0);
+        st->len++;
+        st->state = 0;
+        line++;
+        n--;
+    }
+
+    pairs = n / 2;
+    if (pairs > size - st->len)
+        pairs = size - st->len;
+    if (pairs > 0) {
+        merge(line, pairs, frame + st->len);
+        st->len += pairs;
+        line += pairs * 2;
+        n -= pairs * 2;
+    }
+
+    if (n > 0 && st->len < size) {
+        frame[st->len] = *line;
+        st->state = 1;
+    }
+}
+
+static void cobs_decode(struct LC_STATE *st, const unsigned char *line, int n,
+    unsigned char *frame, int size)
+{
+    int i, run;
+
+    for (i = 0; i < n; ) {
+        if (st->state == 0) {
+            /* code byte: the previous run's implied zero is now known to be data */
+            if (st->zero && st->len < size)
+                frame[st->len++] = 0;
+            st->state = line[i] - 1;
+            st->zero = line[i] < 0xff;
+            i++;
+            continue;
+        }
+
+        run = n - i < st->state ? n - i : st->state;
+        if (run > size - st->len)
+            run = size - st->len;
+        if (run <= 0) {
+            /* frame buffer full, drop the rest of the run */
+            run = n - i < st->state ? n - i : st->state;
+        } else {
+            memcpy(frame + st->len, line + i, run);
+            st->len += run;
+        }
+        st->state -= run;
+        i += run;
+    }
+}
+
+void lc_decode(int code, struct LC_STATE *st, const unsigned char *line, int n,
+    unsigned char *frame, int size)
+{
+    if (code == LINECODE_COBS)
+        cobs_decode(st, line, n, frame, size);
+    else
+        nibble_decode(st, line, n, frame, size);
+}
+
+#ifdef LINECODE_BENCH
+
+/* Microbenchmark of the nibble kernels: cc -O2 -DLINECODE_BENCH linecode.c */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifdef LC_X86
+#include <x86intrin.h>
+#define UNIT "cycle"
+#define ticks() ((double)__rdtsc())
+#else
+#define UNIT "ns"
+#define ticks() ((double)clock() * 1e9 / CLOCKS_PER_SEC)
+#endif
+
+#define NBYTES (64 * 1024)
+#define ROUNDS 2000
+
+static struct {
+    const char *name;
+    void (*split)(const unsigned char *in, int n, unsigned char *out);
+    void (*merge)(const unsigned char *in, int n, unsigned char *out);
+} kernels[] = {
+    { "scalar", split_scalar, merge_scalar },
+#ifdef LC_X86
+    { "sse2", split_sse2, merge_sse2 },
+    { "avx2", split_avx2, merge_avx2 },
+#endif
+};
+
+int main(void)
+{
+    static unsigned char frame[NBYTES], line[NBYTES * 2], back[NBYTES];
+    double t0, t_split, t_merge;
+    int i, k;
+
+    for (i = 0; i < NBYTES; i++)
+        frame[i] = (unsigned char)rand();
+
+    printf("best kernel: %s\n", lc_init());
+    printf("%-8s %10s %10s  (frame bytes per %s)\n", "kernel", "split", "merge", UNIT);
+
+    for (k = 0; k < (int)(sizeof(kernels) / sizeof(kernels[0])); k++) {
+#ifdef LC_X86
+        if (k == 2 && !__builtin_cpu_supports("avx2"))
+            break;
+#endif
+        t0 = ticks();
+        for (i = 0; i < ROUNDS; i++)
+            kernels[k].split(frame, NBYTES, line);
+        t_split = ticks() - t0;
+
+        t0 = ticks();
+        for (i = 0; i < ROUNDS; i++)
+            kernels[k].merge(line, NBYTES, back);
+        t_merge = ticks() - t0;
+
+        if (memcmp(frame, back, NBYTES) != 0) {
+            printf("%s: kernel mismatch\n", kernels[k].name);
+            return 1;
+        }
+
+        printf("%-8s %10.2f %10.2f\n", kernels[k].name,
+            (double)NBYTES * ROUNDS / t_split, (double)NBYTES * ROUNDS / t_merge);
+    }
+
+    return 0;
+}
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef __LINECODE_H__
+#define __LINECODE_H__
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/* Line codes of the physical layer */
+#define LINECODE_NIBBLE 0 /* one byte per nibble, 0xff delimiters */
+#define LINECODE_COBS   1 /* consistent overhead byte stuffing, 0x00 delimiter */
+
+/* Decoding state of a frame under reassembly */
+struct LC_STATE {
+    int len;   /* decoded bytes */
+    int state; /* nibble: low nibble pending; COBS: bytes left in the run */
+    int zero;  /* COBS: the run ends with an implied zero byte */
+};
+
+/* Select the fastest kernels this CPU runs, return their name */
+extern const char *lc_init(void);
+
+extern const char *lc_name(int code);
+extern int lc_lookup(const char *name);
+
+/* frame delimiter and payload bits carried by each line byte */
+extern unsigned char lc_delimiter(int code);
+extern int lc_bits(int code);
+
+/* worst case line bytes for a 'len'-byte frame, delimiters included */
+extern int lc_bound(int code, int len);
+
+/* Encode one frame with its delimiters, return the line bytes written */
+extern int lc_encode(int code, const unsigned char *frame, int len, unsigned char *line);
+
+/* Offset of the first delimiter in 'line', 'n' if there is none */
+extern int lc_find(int code, const unsigned char *line, int n);
+
+/* Decode 'n' line bytes free of delimiters, appending to 'frame' (at most 'size' bytes) */
+extern void lc_decode(int code, struct LC_STATE *st, const unsigned char *line, int n,
+    unsigned char *frame, int size);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
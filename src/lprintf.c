@@ -9,6 +9,7 @@
 
 #else
 #define __int64 long long
+#include <pthread.h>
 #endif
 
 #include <sys/types.h>
@@ -21,6 +22,13 @@
 #include "lprintf.h"
 
 FILE *log_file = NULL;
+char *(*log_tag)(void) = NULL;
+
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
 
 #define bool int
 #define true 1
@@ -44,7 +52,7 @@ static unsigned long skip_to(const char *format) {
 
 static int output(const char *str, int len)
 {
-	static bool sol = true; /* start of line */
+	static THREAD_LOCAL bool sol = true; /* start of line */
 	unsigned int ms, n;
 	char timestamp[32];
 	const char *head, *tail, *end = str + len;
@@ -54,6 +62,8 @@ static int output(const char *str, int len)
 		if (sol) {
 			ms = get_ms();
 			n = sprintf(timestamp, "%03d.%03d ", ms / 1000, ms % 1000);
+			if (log_tag)
+				n += sprintf(timestamp + n, "%s ", log_tag());
 			tee_output(timestamp, n);
 		}
 		tee_output(head, tail - head);
@@ -361,7 +371,7 @@ static int output_memory_block(const unsigned char *ptr, int n,
     return len;
 }
 
-int __v_lprintf(const char *format, va_list arg_ptr)
+static int v_lprintf(const char *format, va_list arg_ptr)
 {
     unsigned int len = 0;
     int err = errno;
@@ -569,6 +579,25 @@ print_num:
     return len;
 }
 
+#ifndef _WIN32
+/* stations sharing a process print whole calls, not interleaved pieces */
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+int __v_lprintf(const char *format, va_list arg_ptr)
+{
+    int n;
+
+#ifndef _WIN32
+    pthread_mutex_lock(&log_lock);
+#endif
+    n = v_lprintf(format, arg_ptr);
+#ifndef _WIN32
+    pthread_mutex_unlock(&log_lock);
+#endif
+    return n;
+}
+
 int lprintf(const char *format,...)
 {
     int n;
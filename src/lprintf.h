@@ -11,6 +11,9 @@ extern "C"
 extern FILE *log_file;
 extern unsigned int get_ms(void);
 
+/* if set, names the writer of each line after its timestamp */
+extern char *(*log_tag)(void);
+
 int lprintf(const char *format, ...);
 int __v_lprintf(const char *format, va_list arg_ptr);
 
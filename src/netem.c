@@ -0,0 +1,163 @@
+/*
+    Frame impairments of the simulated physical layer
+
+    After the line is delimited every frame is dropped, duplicated or
+    given a delay of its own around the channel delay, like netem does
+    for packets. Received bytes are committed ne_lead() ms early so that
+    a frame can arrive ahead of the channel delay as well as behind it;
+    without reordering a frame never overtakes the one before.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "netem.h"
+
+#ifdef _WIN32
+#define strncasecmp _strnicmp
+#define strcasecmp _stricmp
+#else
+#include <strings.h>
+#endif
+
+#define PARETO_ALPHA 2.5
+#define PARETO_CAP 100 /* longest extra delay, in jitters */
+
+static const char *ne_dists[] = { "uniform", "normal", "pareto" };
+
+static int ne_prob(const char *str, double *p)
+{
+    char *end;
+
+    *p = strtod(str, &end);
+    if (*end == '%') {
+        *p /= 100;
+        end++;
+    }
+    return end == str || *end || *p < 0.0 || *p > 1.0 ? -1 : 0;
+}
+
+int ne_parse(struct NE_CONFIG *cfg, const char *spec)
+{
+    char buf[256], *item, *arg, *end;
+    int i;
+
+    if (strlen(spec) >= sizeof(buf))
+        return -1;
+    strcpy(buf, spec);
+
+    for (item = strtok(buf, ","); item; item = strtok(NULL, ",")) {
+        if ((arg = strchr(item, '=')) != NULL)
+            *arg++ = 0;
+
+        if (strcasecmp(item, "reorder") == 0 && arg == NULL)
+            cfg->reorder = 1;
+        else if (arg == NULL)
+            return -1;
+        else if (strcasecmp(item, "loss") == 0) {
+            if (ne_prob(arg, &cfg->loss) < 0)
+                return -1;
+        } else if (strcasecmp(item, "dup") == 0) {
+            if (ne_prob(arg, &cfg->dup) < 0)
+                return -1;
+        } else if (strcasecmp(item, "jitter") == 0) {
+            cfg->jitter = strtod(arg, &end);
+            if (end == arg || cfg->jitter < 0.0 || cfg->jitter > 60000.0)
+                return -1;
+            if (*end == ':') {
+                for (i = 0; i < (int)(sizeof(ne_dists) / sizeof(ne_dists[0])); i++) {
+                    if (strcasecmp(end + 1, ne_dists[i]) == 0)
+                        break;
+                }
+                if (i == sizeof(ne_dists) / sizeof(ne_dists[0]))
+                    return -1;
+                cfg->dist = i;
+            } else if (*end)
+                return -1;
+        } else
+            return -1;
+    }
+
+    cfg->active = cfg->jitter > 0.0 || cfg->loss > 0.0 || cfg->dup > 0.0;
+    return 0;
+}
+
+void ne_init(struct NE_STATE *st, const struct NE_CONFIG *cfg, double (*uniform)(void))
+{
+    memset(st, 0, sizeof(*st));
+    st->cfg = cfg;
+    st->uniform = uniform;
+}
+
+int ne_lead(const struct NE_CONFIG *cfg)
+{
+    switch (cfg->dist) {
+    case NE_UNIFORM:
+        return (int)ceil(cfg->jitter);
+    case NE_NORMAL:
+        return (int)ceil(3 * cfg->jitter);
+    }
+    return 0;
+}
+
+int ne_jitter(struct NE_STATE *st)
+{
+    const struct NE_CONFIG *cfg = st->cfg;
+    double d = 0.0;
+
+    if (cfg->jitter <= 0.0)
+        return 0;
+
+    switch (cfg->dist) {
+    case NE_UNIFORM:
+        d = (2 * st->uniform() - 1) * cfg->jitter;
+        break;
+    case NE_NORMAL:
+        /* Box-Muller, one of the pair */
+        d = sqrt(-2 * log(st->uniform())) * cos(2 * 3.14159265358979 * st->uniform()) * cfg->jitter;
+        if (d < -3 * cfg->jitter)
+            d = -3 * cfg->jitter;
+        if (d > 3 * cfg->jitter)
+            d = 3 * cfg->jitter;
+        break;
+    case NE_PARETO:
+        /* excess of a Pareto variable over its minimum, scaled to average 'jitter' */
+        d = (pow(st->uniform(), -1 / PARETO_ALPHA) - 1) * (PARETO_ALPHA - 1) * cfg->jitter;
+        if (d > PARETO_CAP * cfg->jitter)
+            d = PARETO_CAP * cfg->jitter;
+        break;
+    }
+    return (int)floor(d + 0.5);
+}
+
+int ne_lose(struct NE_STATE *st)
+{
+    st->frames++;
+    if (st->cfg->loss > 0.0 && st->uniform() <= st->cfg->loss) {
+        st->lost++;
+        return 1;
+    }
+    return 0;
+}
+
+int ne_duplicate(struct NE_STATE *st)
+{
+    if (st->cfg->dup > 0.0 && st->uniform() <= st->cfg->dup) {
+        st->dups++;
+        return 1;
+    }
+    return 0;
+}
+
+const char *ne_describe(const struct NE_CONFIG *cfg, char *buf)
+{
+    if (!cfg->active) {
+        strcpy(buf, "none");
+        return buf;
+    }
+    sprintf(buf, "jitter %g ms %s, loss %.1E, duplication %.1E, %s",
+        cfg->jitter, ne_dists[cfg->dist], cfg->loss, cfg->dup, cfg->reorder ? "reordering" : "in order");
+    return buf;
+}
@@ -0,0 +1,53 @@
+#ifndef __NETEM_H__
+#define __NETEM_H__
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/* Frame impairments of the physical layer, applied to delimited frames */
+#define NE_UNIFORM 0 /* jitter evenly spread over [-jitter, +jitter] */
+#define NE_NORMAL  1 /* jitter is the standard deviation, cut at 3 of them */
+#define NE_PARETO  2 /* heavy tail: extra delay only, averaging jitter */
+
+struct NE_CONFIG {
+    int active;
+    int dist;
+    double jitter;  /* ms */
+    double loss;    /* probability a frame is dropped */
+    double dup;     /* probability a frame arrives twice */
+    int reorder;    /* jitter may let a frame overtake earlier ones */
+};
+
+/* Impairment counters of one receiving station */
+struct NE_STATE {
+    const struct NE_CONFIG *cfg;
+    double (*uniform)(void); /* random numbers in (0, 1] */
+    unsigned long long frames, lost, dups, reordered; /* frames: all delimited */
+};
+
+/* Parse "jitter=<ms>[:uniform|normal|pareto],loss=<p>,dup=<p>,reorder" in any order, -1 on errors */
+extern int ne_parse(struct NE_CONFIG *cfg, const char *spec);
+
+extern void ne_init(struct NE_STATE *st, const struct NE_CONFIG *cfg, double (*uniform)(void));
+
+/* Most a frame may arrive ahead of the channel delay (ms) */
+extern int ne_lead(const struct NE_CONFIG *cfg);
+
+/* Delay of a frame relative to the channel delay (ms), never below -ne_lead() */
+extern int ne_jitter(struct NE_STATE *st);
+
+/* 1 if the frame is dropped, called once per delimited frame */
+extern int ne_lose(struct NE_STATE *st);
+
+/* 1 if the frame is duplicated */
+extern int ne_duplicate(struct NE_STATE *st);
+
+/* One-line description of the configuration */
+extern const char *ne_describe(const struct NE_CONFIG *cfg, char *buf);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
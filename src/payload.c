@@ -0,0 +1,301 @@
+/*
+    Counter-based payload of the simulated network layer
+
+    Word 'i' (4 bytes, little endian) of a payload is the murmur3
+    finalizer of key + i * golden ratio. The finalizer is a bijection of
+    32-bit words, so no two words of a payload repeat, and every word is
+    independent of the others: SSE2 and AVX2 kernels compute 4 or 8 at
+    once, and checking is generate, XOR and OR-reduce.
+*/
+
+#include <string.h>
+
+#include "payload.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PL_X86
+#include <immintrin.h>
+#define PL_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+#define GOLDEN 0x9e3779b9u
+#define C1 0x85ebca6bu
+#define C2 0xc2b2ae35u
+
+static unsigned int fmix32(unsigned int h)
+{
+    h ^= h >> 16;
+    h *= C1;
+    h ^= h >> 13;
+    h *= C2;
+    h ^= h >> 16;
+    return h;
+}
+
+unsigned int pl_key(unsigned int seed, unsigned int id)
+{
+    return fmix32(seed ^ fmix32(id + GOLDEN));
+}
+
+/* Kernels: fill or check bytes from word 'w' on; check returns non-zero on a mismatch */
+
+static void fill_scalar(unsigned int key, unsigned int w, unsigned char *buf, int n)
+{
+    unsigned int x;
+    int i, k;
+
+    for (i = 0; i < n; i += 4, w++) {
+        x = fmix32(key + w * GOLDEN);
+        for (k = 0; k < 4 && i + k < n; k++, x >>= 8)
+            buf[i + k] = (unsigned char)x;
+    }
+}
+
+static int check_scalar(unsigned int key, unsigned int w, const unsigned char *buf, int n)
+{
+    unsigned int x, diff = 0;
+    int i, k;
+
+    for (i = 0; i < n; i += 4, w++) {
+        x = fmix32(key + w * GOLDEN);
+        for (k = 0; k < 4 && i + k < n; k++, x >>= 8)
+            diff |= buf[i + k] ^ (x & 0xff);
+    }
+    return diff != 0;
+}
+
+#ifdef PL_X86
+
+/* SSE2 has no 32-bit multiply-low: two 32x32->64 products of the even and odd lanes */
+PL_TARGET("sse2")
+static __m128i mullo_sse2(__m128i a, __m128i b)
+{
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, 0x08), _mm_shuffle_epi32(odd, 0x08));
+}
+
+PL_TARGET("sse2")
+static __m128i fmix_sse2(__m128i h)
+{
+    h = _mm_xor_si128(h, _mm_srli_epi32(h, 16));
+    h = mullo_sse2(h, _mm_set1_epi32((int)C1));
+    h = _mm_xor_si128(h, _mm_srli_epi32(h, 13));
+    h = mullo_sse2(h, _mm_set1_epi32((int)C2));
+    return _mm_xor_si128(h, _mm_srli_epi32(h, 16));
+}
+
+PL_TARGET("sse2")
+static __m128i lanes_sse2(unsigned int key, unsigned int w)
+{
+    return _mm_add_epi32(_mm_set1_epi32((int)(key + w * GOLDEN)),
+        _mm_setr_epi32(0, (int)GOLDEN, (int)(2 * GOLDEN), (int)(3 * GOLDEN)));
+}
+
+/* the last partial vector goes through a stack copy, staying in one instruction set */
+PL_TARGET("sse2")
+static void fill_sse2(unsigned int key, unsigned int w, unsigned char *buf, int n)
+{
+    const __m128i step = _mm_set1_epi32((int)(4 * GOLDEN));
+    __m128i x = lanes_sse2(key, w), tail;
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        _mm_storeu_si128((__m128i *)(buf + i), fmix_sse2(x));
+        x = _mm_add_epi32(x, step);
+    }
+    if (i < n) {
+        tail = fmix_sse2(x);
+        memcpy(buf + i, &tail, n - i);
+    }
+}
+
+PL_TARGET("sse2")
+static int check_sse2(unsigned int key, unsigned int w, const unsigned char *buf, int n)
+{
+    const __m128i step = _mm_set1_epi32((int)(4 * GOLDEN));
+    __m128i x = lanes_sse2(key, w), diff = _mm_setzero_si128(), tail;
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        diff = _mm_or_si128(diff, _mm_xor_si128(fmix_sse2(x), _mm_loadu_si128((const __m128i *)(buf + i))));
+        x = _mm_add_epi32(x, step);
+    }
+    if (i < n) {
+        tail = _mm_setzero_si128();
+        memcpy(&tail, buf + i, n - i);
+        x = fmix_sse2(x);
+        memset((unsigned char *)&x + (n - i), 0, 16 - (n - i));
+        diff = _mm_or_si128(diff, _mm_xor_si128(x, tail));
+    }
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) != 0xffff;
+}
+
+PL_TARGET("avx2")
+static __m256i fmix_avx2(__m256i h)
+{
+    h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 16));
+    h = _mm256_mullo_epi32(h, _mm256_set1_epi32((int)C1));
+    h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 13));
+    h = _mm256_mullo_epi32(h, _mm256_set1_epi32((int)C2));
+    return _mm256_xor_si256(h, _mm256_srli_epi32(h, 16));
+}
+
+PL_TARGET("avx2")
+static __m256i lanes_avx2(unsigned int key, unsigned int w)
+{
+    return _mm256_add_epi32(_mm256_set1_epi32((int)(key + w * GOLDEN)),
+        _mm256_setr_epi32(0, (int)GOLDEN, (int)(2 * GOLDEN), (int)(3 * GOLDEN),
+            (int)(4 * GOLDEN), (int)(5 * GOLDEN), (int)(6 * GOLDEN), (int)(7 * GOLDEN)));
+}
+
+PL_TARGET("avx2")
+static void fill_avx2(unsigned int key, unsigned int w, unsigned char *buf, int n)
+{
+    const __m256i step = _mm256_set1_epi32((int)(8 * GOLDEN));
+    __m256i x = lanes_avx2(key, w), tail;
+    int i;
+
+    for (i = 0; i + 32 <= n; i += 32) {
+        _mm256_storeu_si256((__m256i *)(buf + i), fmix_avx2(x));
+        x = _mm256_add_epi32(x, step);
+    }
+    if (i < n) {
+        tail = fmix_avx2(x);
+        memcpy(buf + i, &tail, n - i);
+    }
+}
+
+PL_TARGET("avx2")
+static int check_avx2(unsigned int key, unsigned int w, const unsigned char *buf, int n)
+{
+    const __m256i step = _mm256_set1_epi32((int)(8 * GOLDEN));
+    __m256i x = lanes_avx2(key, w), diff = _mm256_setzero_si256(), tail;
+    int i;
+
+    for (i = 0; i + 32 <= n; i += 32) {
+        diff = _mm256_or_si256(diff, _mm256_xor_si256(fmix_avx2(x), _mm256_loadu_si256((const __m256i *)(buf + i))));
+        x = _mm256_add_epi32(x, step);
+    }
+    if (i < n) {
+        tail = _mm256_setzero_si256();
+        memcpy(&tail, buf + i, n - i);
+        x = fmix_avx2(x);
+        memset((unsigned char *)&x + (n - i), 0, 32 - (n - i));
+        diff = _mm256_or_si256(diff, _mm256_xor_si256(x, tail));
+    }
+    return !_mm256_testz_si256(diff, diff);
+}
+
+#endif /* PL_X86 */
+
+static void (*fill)(unsigned int key, unsigned int w, unsigned char *buf, int n) = fill_scalar;
+static int (*check)(unsigned int key, unsigned int w, const unsigned char *buf, int n) = check_scalar;
+static const char *kernel = "scalar";
+
+const char *pl_init(void)
+{
+#ifdef PL_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        fill = fill_avx2;
+        check = check_avx2;
+        kernel = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        fill = fill_sse2;
+        check = check_sse2;
+        kernel = "sse2";
+    }
+#endif
+    return kernel;
+}
+
+void pl_fill(unsigned int key, unsigned char *buf, int n)
+{
+    fill(key, 0, buf, n);
+}
+
+int pl_check(unsigned int key, const unsigned char *buf, int n)
+{
+    return check(key, 0, buf, n) == 0;
+}
+
+#ifdef PAYLOAD_BENCH
+
+/* Microbenchmark of the payload kernels: cc -O2 -DPAYLOAD_BENCH payload.c */
+
+#include <stdio.h>
+#include <time.h>
+
+#ifdef PL_X86
+#include <x86intrin.h>
+#define UNIT "cycle"
+#define ticks() ((double)__rdtsc())
+#else
+#define UNIT "ns"
+#define ticks() ((double)clock() * 1e9 / CLOCKS_PER_SEC)
+#endif
+
+#define NBYTES 254 /* payload of a packet */
+#define ROUNDS 1000000
+
+static struct {
+    const char *name;
+    void (*fill)(unsigned int key, unsigned int w, unsigned char *buf, int n);
+    int (*check)(unsigned int key, unsigned int w, const unsigned char *buf, int n);
+} kernels[] = {
+    { "scalar", fill_scalar, check_scalar },
+#ifdef PL_X86
+    { "sse2", fill_sse2, check_sse2 },
+    { "avx2", fill_avx2, check_avx2 },
+#endif
+};
+
+int main(void)
+{
+    static unsigned char ref[NBYTES], buf[NBYTES];
+    double t0, t_fill, t_check;
+    int i, k, bad = 0;
+
+    printf("best kernel: %s\n", pl_init());
+    printf("%-8s %10s %10s  (payload bytes per %s)\n", "kernel", "fill", "check", UNIT);
+
+    for (k = 0; k < (int)(sizeof(kernels) / sizeof(kernels[0])); k++) {
+#ifdef PL_X86
+        if (k == 2 && !__builtin_cpu_supports("avx2"))
+            break;
+#endif
+        for (i = 1; i <= NBYTES; i++) {
+            fill_scalar(12345, 0, ref, i);
+            memset(buf, 0, sizeof(buf));
+            kernels[k].fill(12345, 0, buf, i);
+            if (memcmp(ref, buf, i) != 0 || kernels[k].check(12345, 0, ref, i) != 0)
+                bad = 1;
+            buf[i - 1] ^= 0x10;
+            if (kernels[k].check(12345, 0, buf, i) == 0)
+                bad = 1;
+        }
+        if (bad) {
+            printf("%s: kernel mismatch\n", kernels[k].name);
+            return 1;
+        }
+
+        t0 = ticks();
+        for (i = 0; i < ROUNDS; i++)
+            kernels[k].fill((unsigned int)i, 0, buf, NBYTES);
+        t_fill = ticks() - t0;
+
+        t0 = ticks();
+        for (i = 0; i < ROUNDS; i++)
+            bad |= kernels[k].check((unsigned int)i, 0, buf, NBYTES) == 0 && i == 0;
+        t_check = ticks() - t0;
+
+        printf("%-8s %10.2f %10.2f\n", kernels[k].name,
+            (double)NBYTES * ROUNDS / t_fill, (double)NBYTES * ROUNDS / t_check);
+    }
+
+    return 0;
+}
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef __PAYLOAD_H__
+#define __PAYLOAD_H__
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Counter-based test payload: byte 'i' of a packet depends only on the
+ * packet key and 'i', so packets are generated and verified in any order
+ * and in batches, 32 bytes per step.
+ */
+
+/* Select the fastest kernels this CPU runs, return their name */
+extern const char *pl_init(void);
+
+/* Key of the payload of packet 'id' in a run seeded with 'seed' */
+extern unsigned int pl_key(unsigned int seed, unsigned int id);
+
+extern void pl_fill(unsigned int key, unsigned char *buf, int n);
+
+/* 1 if 'buf' holds the payload of 'key' */
+extern int pl_check(unsigned int key, const unsigned char *buf, int n);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
@@ -2,16 +2,31 @@
 #define _CRT_SECURE_NO_WARNINGS
 #endif
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <limits.h>
 #include <time.h>
 
-static time_t epoch; /* epoch timestamp (be same for Station A & B) */
+static time_t epoch; /* wall-clock time at the start of the run, for the log */
+static long long epoch_us; /* start of the run on the monotonic clock (us), the same for Station A & B */
+static int mode_local = 0; /* both stations in this process: LOCAL_VIRTUAL or LOCAL_PAIR */
+
+#define LOCAL_VIRTUAL 1 /* one station at a time on a virtual clock */
+#define LOCAL_PAIR 2 /* two concurrent threads on the real clock */
+
+static int mode_switch = 0; /* in-process stations joined by a switch: how many */
+static int mode_replay = 0; /* one station fed from a recording, no peer */
+static int mode_uring = 0; /* TCP through io_uring where the kernel has it */
+static int mode_launch = 0; /* station B forked by station A over a socket pair */
+static unsigned int replay_ms = 1; /* clock of a replay, jumps from event to event; 0 reads as unset */
 
 #ifdef _WIN32 /* for Windows Visual Studio */
 
 #include "getopt.h"
 #include <io.h>
 #include <stdio.h>
-#include <sys/timeb.h>
 #include <sys/types.h>
 #include <winsock.h>
 
@@ -32,13 +47,22 @@ static void socket_init(void)
     }
 }
 
-unsigned int get_ms(void)
+/* QueryPerformanceCounter(): monotonic, and the same in every process of the machine */
+static long long clock_us(void)
 {
-    struct _timeb tm;
+    LARGE_INTEGER freq, count;
+
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return count.QuadPart / freq.QuadPart * 1000000 + count.QuadPart % freq.QuadPart * 1000000 / freq.QuadPart;
+}
 
-    _ftime(&tm);
+long long get_us(void)
+{
+    if (mode_replay)
+        return (long long)replay_ms * 1000;
 
-    return (unsigned int)(epoch ? (tm.time - epoch) * 1000 + tm.millitm : 0);
+    return epoch_us ? clock_us() - epoch_us : 0;
 }
 
 #pragma comment(lib, "wsock32.lib")
@@ -50,36 +74,77 @@ unsigned int get_ms(void)
 #include <errno.h>
 #include <getopt.h>
 #include <netdb.h>
+#include <pthread.h>
 #include <netinet/tcp.h>
+#include <poll.h>
+#include <sched.h>
 #include <stdlib.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
-#include <sys/time.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
 #define stricmp strcasecmp
 #define Sleep(ms) usleep((ms)*1000)
 #define socket_init()
 
-unsigned int get_ms(void)
+/* one round of a busy-poll: spare the sibling hyperthread, or give way where there is no such hint */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define spin_pause() __builtin_ia32_pause()
+#else
+#define spin_pause() sched_yield()
+#endif
+
+#include "shmring.h"
+#include "simchan.h"
+#include "spsc.h"
+#include "switch.h"
+#include "realtime.h"
+#include "uring.h"
+
+/* CLOCK_MONOTONIC: it does not step with the wall clock, and is the same in every process of the machine */
+static long long clock_us(void)
 {
-    struct timeval tm;
-    struct timezone tz;
+    struct timespec ts;
 
-    gettimeofday(&tm, &tz);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+long long get_us(void)
+{
+    /* in-process runs keep a virtual or shared clock of milliseconds */
+    if (mode_local)
+        return (long long)sc_now() * 1000;
+    if (mode_replay)
+        return (long long)replay_ms * 1000;
 
-    return (unsigned int)(epoch ? (tm.tv_sec - epoch) * 1000 + tm.tv_usec / 1000 : 0);
+    return epoch_us ? clock_us() - epoch_us : 0;
 }
 
 #endif
 
+/* get_us() for millisecond callers */
+unsigned int get_ms(void)
+{
+    return (unsigned int)(get_us() / 1000);
+}
+
 #include <math.h>
 
+#include "errmodel.h"
+#include "linecode.h"
+#include "netem.h"
+#include "payload.h"
+#include "record.h"
+#include "rng.h"
+#include "schedule.h"
+#include "traffic.h"
 #include "protocol.h"
 
-/* channel parameters */
-#define CHAN_DELAY 270 /* ms */
-#define CHAN_BPS 8000 /* bits per second */
-
 #define ABORT(s)                             \
     do {                                     \
         lprintf("\nFATAL: %s\nAbort.\n", s); \
@@ -88,7 +153,11 @@ unsigned int get_ms(void)
 
 #define DEFAULT_TICK 15 /* ms */
 #define DEFAULT_CHAN_BER 1.0E-5 /* Bit Error Rate */
+#define DEFAULT_CHAN_BPS 8000 /* bits per second */
+#define DEFAULT_CHAN_DELAY 270 /* ms */
+#define DEFAULT_CHAN_QUEUE (128 * 1024) /* bytes of sending queue, at most */
 #define DEFAULT_PORT 59144
+#define PHL_SQ_LEVEL 50 /* bytes, the least low watermark of the sending queue */
 
 #define NMAGIC 32
 #define HEAD_MAGIC 0xa5a5e41b
@@ -96,31 +165,475 @@ unsigned int get_ms(void)
 
 static void magic_init(void);
 static void magic_check(void);
+static void phl_init(void);
+static void nl_init(void);
+#ifndef _WIN32
+static void io_start(void);
+#endif
 
 static unsigned int head_magic[NMAGIC];
 
 /* Parameters */
-static int station;
+static STATION_LOCAL int station; /* 'a' or 'b', the end of the session */
+static STATION_LOCAL int session; /* the pair of stations this thread is one end of */
 static double ber = DEFAULT_CHAN_BER; /* Bit Error Rate */
 static int mode_ibib = 0; /* 0: BUSY-IDLE-BUSY-..., 1: IDLE-BUSY-BUSY-... */
 static int mode_flood = 0; /* flood mode */
 static int mode_cycle = 100; /* seconds */
 static int mode_life = 0x7fffff00;
 static int mode_tick = DEFAULT_TICK;
-static int mode_seed = 0x098bcde1;
+static unsigned int mode_seed = 0x098bcde1;
 static int debug_mask = 0; /* debug mask */
 static unsigned short port = DEFAULT_PORT;
+static int linecode = LINECODE_NIBBLE;
+static int line_bits = 4; /* payload bits carried by a line byte */
+static int chan_bps = DEFAULT_CHAN_BPS;
+static int chan_delay = DEFAULT_CHAN_DELAY; /* ms */
+static int sq_size = DEFAULT_CHAN_QUEUE;
+static int sq_low, sq_high; /* sending queue watermarks: PHYSICAL_LAYER_READY below, network layer held above */
+static int blk_size; /* bytes of a receive block */
+static int fabric_bps = 0; /* switch fabric, 0: non-blocking */
+static int nsession = 1;
+static unsigned char (*sessions)[2]; /* switch: the stations, 0 for A, at the 'a' and 'b' ends of each session */
+
+/* channel profiles, --rate, --delay and --queue override a field */
+static const struct CHAN_PROFILE {
+    const char* name;
+    int bps;
+    int delay; /* ms */
+    int queue; /* bytes */
+} chan_profiles[] = {
+    { "classic", DEFAULT_CHAN_BPS, DEFAULT_CHAN_DELAY, DEFAULT_CHAN_QUEUE },
+    { "satellite", 2000000, 270, 1024 * 1024 },
+    { "wan", 10000000, 40, 1024 * 1024 },
+    { "lan", 100000000, 1, 4 * 1024 * 1024 },
+};
+
+static STATION_LOCAL int sock;
+static int phl_gone; /* the peer hung up as the run ended, this station quits too */
+static STATION_LOCAL int now; /* timestamp (ms) */
+static STATION_LOCAL long long now_us; /* the same in us, what timers, the pacer and the line run on */
+static struct EM_CONFIG em_cfg; /* bit-error model of the channel */
+static STATION_LOCAL struct EM_CONFIG rx_em; /* em_cfg as the schedule leaves the direction received on */
+static STATION_LOCAL struct EM_STATE em; /* errors imposed on what this station receives */
+static STATION_LOCAL int tx_bps, rx_delay; /* rate sent at and delay received with, as scheduled */
+static struct SCHEDULE sched; /* channel changes over time, none without --schedule */
+static struct TM_CONFIG tm_cfg; /* traffic model of the network layer */
+static char tm_spec[1024]; /* --traffic as given, kept with a recording */
+static const char* rec_name; /* --record file */
+static STATION_LOCAL struct RECORDER rec_out; /* what this station receives and sends */
+static struct RECORDER rec_in, rec_tx; /* replay: blocks fed to the station, frames it should send */
+static struct NE_CONFIG ne_cfg; /* frame impairments of the channel */
+static char ne_spec[256], sch_name[1024]; /* --netem and --schedule as given, kept with a recording */
+static STATION_LOCAL struct NE_STATE ne; /* impairments imposed on the frames this station receives */
+static int chan_lead; /* ms received bytes are committed early, so frames can arrive ahead of the delay */
+
+/* commits may slip this much (ms) to share a wakeup with the send slot */
+#define COMMIT_SLACK (chan_delay / 27 < 10 ? chan_delay / 27 : 10)
+
+/* random streams, each station draws from its own */
+#define RNG_NOISE 0
+#define RNG_TRAFFIC 1
+#define RNG_NETEM 2
+#define rng_stream(kind, st) ((kind) * 2 + (st) - 'a' + 8 * session)
+
+static STATION_LOCAL struct RNG rng_noise, rng_traffic, rng_netem;
+
+/* I/O thread: the line, the pacer and reassembly run apart from the protocol, whole frames cross over rings */
+static int io_thread = 0;
+static STATION_LOCAL int io_self; /* this thread is the I/O thread */
+#ifndef _WIN32
+static int io_efd = -1; /* eventfd kicking the I/O thread out of ppoll() */
+static struct SPSC io_tx, io_rx; /* frames sent by the protocol thread, frames due to it */
+static struct SPSC_BELL io_bell; /* the protocol thread sleeps on it */
+static struct SPSC_BELL io_quit_bell; /* the I/O thread sleeps on it once the peer is gone, until stopped */
+static unsigned int io_sq; /* sq_len() as the I/O thread last saw it */
+static unsigned int io_asleep, io_quit, io_kicks;
+static unsigned int io_drops; /* frames the tx ring refused, counted by the protocol thread */
+static pthread_t io_tid;
+static int io_sock, io_rpackets; /* handed to the I/O thread at start and at quit */
+static const struct EM_STATE* io_em; /* the error state of the I/O thread, for the progress line */
+
+static struct RT_CONFIG rt_cfg; /* --realtime */
+#endif
 
-static int sock;
-static int now; /* timestamp (ms) */
-static int noise = 0; /* counter of bit errors */
+/*
+ * Wakeup latency: how far past its deadline a sleep returned, in powers
+ * of 2 of us, kept by each thread that sleeps on the real clock.
+ */
+#define WAKE_HIST 24
+
+static STATION_LOCAL unsigned long long wake_hist[WAKE_HIST], wake_n;
+static STATION_LOCAL long long wake_sum, wake_max;
 
 char* station_name(void)
 {
+    static STATION_LOCAL char name[4];
+
+    /* a station of a switch has a session per neighbour: "A:C" is A's end of the one with C */
+    if (mode_switch && (station == 'a' || station == 'b')) {
+        name[0] = (char)('A' + sessions[session][station - 'a']);
+        name[1] = ':';
+        name[2] = (char)('A' + sessions[session][station == 'a']);
+        return name;
+    }
     return (char*)(station == 'a' ? "A" : station == 'b' ? "B"
                                                          : "XXX");
 }
 
+/* Line Transports: how line bytes get from one station to the other */
+
+#define PHL_READABLE 0x01
+#define PHL_WRITABLE 0x02
+
+struct PHL_OPS {
+    const char* name;
+    /* write p1[n1] then p2[n2], return bytes taken, <= 0 when the peer is gone */
+    int (*send)(const unsigned char* p1, int n1, const unsigned char* p2, int n2);
+    /* fill 'nbuf' buffers of 'size' bytes in turn, return bytes read, 0 if none, < 0 when the peer is gone */
+    int (*recv)(unsigned char** buf, int nbuf, int size);
+    /* sleep until one of the 'want' events or the deadline (us, LLONG_MAX: none), return the events seen */
+    int (*wait)(long long deadline, int want);
+};
+
+/* A deadline of the ms clocks in us, INT_MAX to LLONG_MAX */
+static long long deadline_us(int ms)
+{
+    return ms == INT_MAX ? LLONG_MAX : (long long)ms * 1000;
+}
+
+/* The first ms not before a deadline in us, for the ms clocks */
+static int deadline_ms(long long us)
+{
+    return us == LLONG_MAX ? INT_MAX : (int)((us + 999) / 1000);
+}
+
+static int tcp_send(const unsigned char* p1, int n1, const unsigned char* p2, int n2)
+{
+    int ret;
+
+#ifdef _WIN32
+    ret = send(sock, (char*)p1, n1, 0);
+    if (ret == n1 && n2 > 0) {
+        int ret2 = send(sock, (char*)p2, n2, 0);
+        if (ret2 > 0)
+            ret += ret2;
+    }
+#else
+    struct iovec iov[2];
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+    iov[0].iov_base = (void*)p1;
+    iov[0].iov_len = n1;
+    iov[1].iov_base = (void*)p2;
+    iov[1].iov_len = n2;
+    msg.msg_iov = iov;
+    msg.msg_iovlen = n2 ? 2 : 1;
+    ret = sendmsg(sock, &msg, MSG_NOSIGNAL);
+#endif
+    return ret;
+}
+
+static int tcp_recv(unsigned char** buf, int nbuf, int size)
+{
+    int n;
+
+#ifdef _WIN32
+    n = recv(sock, (char*)buf[0], size, 0);
+    /* SO_RCVTIMEO ran out on an idle line, not a hang-up */
+    if (n < 0 && WSAGetLastError() == WSAETIMEDOUT)
+        return 0;
+#else
+    struct iovec iov[16];
+    struct msghdr msg;
+    int i;
+
+    if (nbuf > 16)
+        nbuf = 16;
+    memset(&msg, 0, sizeof(msg));
+    for (i = 0; i < nbuf; i++) {
+        iov[i].iov_base = buf[i];
+        iov[i].iov_len = size;
+    }
+    msg.msg_iov = iov;
+    msg.msg_iovlen = nbuf;
+    n = recvmsg(sock, &msg, MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return 0;
+#endif
+    return n > 0 ? n : -1;
+}
+
+#ifndef _WIN32
+/* Time left until 'deadline' (us) in 'ts', NULL for no deadline */
+static struct timespec* phl_timeout(long long deadline, struct timespec* ts)
+{
+    long long us;
+
+    if (deadline == LLONG_MAX)
+        return NULL;
+
+    us = deadline - get_us();
+    if (us < 0)
+        us = 0;
+    ts->tv_sec = (time_t)(us / 1000000);
+    ts->tv_nsec = (long)(us % 1000000 * 1000);
+    return ts;
+}
+#endif
+
+static int tcp_wait(long long deadline, int want)
+{
+#ifdef _WIN32
+    fd_set rfd, wfd;
+    struct timeval tm, *tp = NULL;
+    long long us;
+    int ready = 0;
+
+    FD_ZERO(&rfd);
+    FD_ZERO(&wfd);
+    if (want & PHL_READABLE)
+        FD_SET(sock, &rfd);
+    if (want & PHL_WRITABLE)
+        FD_SET(sock, &wfd);
+
+    if (deadline != LLONG_MAX) {
+        us = deadline - get_us();
+        if (us < 0)
+            us = 0;
+        tm.tv_sec = (long)(us / 1000000);
+        tm.tv_usec = (long)(us % 1000000);
+        tp = &tm;
+    }
+
+    if (select(sock + 1, &rfd, &wfd, 0, tp) < 0)
+        ABORT("system select()");
+
+    if (FD_ISSET(sock, &rfd))
+        ready |= PHL_READABLE;
+    if (FD_ISSET(sock, &wfd))
+        ready |= PHL_WRITABLE;
+    return ready;
+#else
+    struct pollfd pfd[2];
+    struct timespec ts;
+    unsigned long long kicks;
+    int ready = 0;
+
+    pfd[0].fd = sock;
+    pfd[0].events = (want & PHL_READABLE ? POLLIN : 0) | (want & PHL_WRITABLE ? POLLOUT : 0);
+    pfd[0].revents = 0;
+    pfd[1].fd = io_efd;
+    pfd[1].events = POLLIN;
+    pfd[1].revents = 0;
+
+    if (ppoll(pfd, io_efd >= 0 ? 2 : 1, phl_timeout(deadline, &ts), NULL) < 0) {
+        if (errno == EINTR)
+            return 0;
+        ABORT("system ppoll()");
+    }
+
+    /* the protocol thread has queued frames, the caller looks at the ring anyway */
+    if (pfd[1].revents & POLLIN)
+        read(io_efd, &kicks, sizeof(kicks));
+
+    if (pfd[0].revents & (POLLIN | POLLHUP | POLLERR))
+        ready |= PHL_READABLE;
+    if (pfd[0].revents & POLLOUT)
+        ready |= PHL_WRITABLE;
+    return ready;
+#endif
+}
+
+static const struct PHL_OPS tcp_ops = { "TCP", tcp_send, tcp_recv, tcp_wait };
+
+#ifndef _WIN32
+/* the other station of an in-process run */
+/* each end of a session is a simchan station, the 'a' end first */
+#define SIM_ME (2 * session + station - 'a')
+#define SIM_PEER (2 * session + (station == 'a' ? 1 : 0))
+
+static int sim_send(const unsigned char* p1, int n1, const unsigned char* p2, int n2)
+{
+    if (mode_switch)
+        return sw_input(SIM_ME, p1, n1, sc_now()) + (n2 ? sw_input(SIM_ME, p2, n2, sc_now()) : 0);
+    return sc_write(SIM_PEER, p1, n1) + (n2 ? sc_write(SIM_PEER, p2, n2) : 0);
+}
+
+static int sim_recv(unsigned char** buf, int nbuf, int size)
+{
+    int i, n, total = 0;
+
+    for (i = 0; i < nbuf; i++) {
+        n = sc_read(buf[i], size);
+        total += n;
+        if (n < size)
+            break;
+    }
+    return total;
+}
+
+static int sim_wait(long long deadline, int want)
+{
+    /* the in-memory line never pushes back, its clock counts ms */
+    return (sc_wait(deadline_ms(deadline), want & PHL_READABLE) ? PHL_READABLE : 0) | PHL_WRITABLE;
+}
+
+static const struct PHL_OPS sim_ops = { "memory", sim_send, sim_recv, sim_wait };
+
+static int shm_send(const unsigned char* p1, int n1, const unsigned char* p2, int n2)
+{
+    int ret = shr_send(p1, n1);
+
+    if (ret == n1 && n2 > 0)
+        ret += shr_send(p2, n2);
+    return ret;
+}
+
+static int shm_recv(unsigned char** buf, int nbuf, int size)
+{
+    int i, n, total = 0;
+
+    for (i = 0; i < nbuf; i++) {
+        n = shr_recv(buf[i], size);
+        if (n < 0)
+            return total ? total : -1;
+        total += n;
+        if (n < size)
+            break;
+    }
+    return total;
+}
+
+static int shm_wait(long long deadline, int want)
+{
+    struct timespec ts;
+    int ready;
+
+    ready = shr_wait(phl_timeout(deadline, &ts), (want & PHL_READABLE ? SHR_INPUT : 0) | (want & PHL_WRITABLE ? SHR_ROOM : 0));
+    return (ready & SHR_INPUT ? PHL_READABLE : 0) | (ready & SHR_ROOM ? PHL_WRITABLE : 0);
+}
+
+static const struct PHL_OPS shm_ops = { "shared memory", shm_send, shm_recv, shm_wait };
+
+static int uring_wait(long long deadline, int want)
+{
+    struct timespec ts;
+    int ready;
+
+    ready = ur_wait(phl_timeout(deadline, &ts), (want & PHL_READABLE ? UR_INPUT : 0) | (want & PHL_WRITABLE ? UR_ROOM : 0), io_efd);
+    return (ready & UR_INPUT ? PHL_READABLE : 0) | (ready & UR_ROOM ? PHL_WRITABLE : 0);
+}
+
+static const struct PHL_OPS uring_ops = { "TCP over io_uring", ur_send, ur_recv, uring_wait };
+
+/* Meet the other station process in a shared memory object named after the port */
+static void shm_connect(void)
+{
+    char name[32];
+    int i, ms;
+    long long epoch;
+
+    sprintf(name, "/datalink-%u", port);
+
+    if (station == 'a') {
+        lprintf("Station A is waiting for station B on shared memory %s ... ", name);
+        fflush(stdout);
+
+        /* the run starts once B is there, at the epoch it takes as it attaches */
+        if (shr_create(name, &epoch_us) < 0)
+            ABORT("Station A failed to create shared memory");
+        lprintf("Done.\n");
+    } else {
+        /* retry soon while station A is still starting, every 2 seconds after that */
+        for (i = 0, ms = 10; i < 60; i++, ms = ms < 1000 ? 2 * ms : 2000) {
+            lprintf("Station B is attaching station A (shared memory %s) ... ", name);
+            fflush(stdout);
+
+            if (shr_attach(name, epoch = clock_us()) < 0) {
+                lprintf("Failed!\n");
+                Sleep(ms);
+            } else {
+                epoch_us = epoch;
+                lprintf("Done.\n");
+                break;
+            }
+        }
+        if (i == 60)
+            ABORT("Station B failed to attach station A");
+    }
+}
+
+static pid_t launch_pid; /* station B, at station A */
+
+/* The command returns once both stations are done */
+static void launch_wait(void)
+{
+    if (launch_pid > 0)
+        waitpid(launch_pid, NULL, 0);
+}
+
+/* Fork station B over a connected socket pair, both on one monotonic epoch; the station of the caller */
+static int launch(void)
+{
+    pid_t parent = getpid();
+    int sv[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+        ABORT("Create socket pair");
+    epoch_us = clock_us();
+
+    fflush(stdout);
+    if ((launch_pid = fork()) < 0)
+        ABORT("Fork station B");
+
+    if (launch_pid == 0) {
+        /* station B does not outlive station A */
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        if (getppid() != parent)
+            exit(0);
+        close(sv[0]);
+        sock = sv[1];
+        return 'b';
+    }
+
+    close(sv[1]);
+    sock = sv[0];
+    atexit(launch_wait);
+    return 'a';
+}
+#endif
+
+/* Replay: the peer is a recording, the line never has input and always has room */
+
+static int replay_send(const unsigned char* p1, int n1, const unsigned char* p2, int n2)
+{
+    (void)p1;
+    (void)p2;
+    return n1 + n2;
+}
+
+static int replay_recv(unsigned char** buf, int nbuf, int size)
+{
+    (void)buf;
+    (void)nbuf;
+    (void)size;
+    return 0;
+}
+
+/* nothing happens in between, so the clock moves straight to the deadline */
+static int replay_wait(long long deadline, int want)
+{
+    if (deadline_ms(deadline) > (int)replay_ms)
+        replay_ms = (unsigned int)deadline_ms(deadline);
+    return want & PHL_WRITABLE;
+}
+
+static const struct PHL_OPS replay_ops = { "replay", replay_send, replay_recv, replay_wait };
+
+static const struct PHL_OPS* phl = &tcp_ops;
+
 static struct option intopts[] = {
     { "help", no_argument, NULL, '?' },
     { "utopia", no_argument, NULL, 'u' },
@@ -132,37 +645,119 @@ static struct option intopts[] = {
     { "ber", required_argument, NULL, 'b' },
     { "log", required_argument, NULL, 'l' },
     { "ttl", required_argument, NULL, 't' },
+    { "code", required_argument, NULL, 'c' },
+    { "virtual", no_argument, NULL, 'v' },
+    { "pair", no_argument, NULL, 'P' },
+    { "transport", required_argument, NULL, 'T' },
+    { "channel", required_argument, NULL, 'C' },
+    { "rate", required_argument, NULL, 'r' },
+    { "delay", required_argument, NULL, 'D' },
+    { "queue", required_argument, NULL, 'q' },
+    { "errors", required_argument, NULL, 'e' },
+    { "seed", required_argument, NULL, 's' },
+    { "netem", required_argument, NULL, 'N' },
+    { "schedule", required_argument, NULL, 'S' },
+    { "traffic", required_argument, NULL, 'm' },
+    { "switch", required_argument, NULL, 'W' },
+    { "fabric", required_argument, NULL, 'F' },
+    { "record", required_argument, NULL, 'R' },
+    { "replay", required_argument, NULL, 'X' },
+    { "io-thread", no_argument, NULL, 'I' },
+    { "launch", no_argument, NULL, 'L' },
+    { "realtime", required_argument, NULL, 'H' },
     { 0, 0, 0, 0 },
 };
 
-#define OPT_SHORT "?ufind:p:b:l:t:"
+#define OPT_SHORT "?ufinm:d:p:b:l:t:c:vPT:C:r:D:q:e:s:N:S:R:X:W:F:ILH:"
+
+/* "2.5M" and the like; -1 if 'str' is not a count */
+static double parse_count(const char* str)
+{
+    char* end;
+    double v = strtod(str, &end);
+
+    switch (tolower(*end)) {
+    case 'k':
+        v *= 1e3, end++;
+        break;
+    case 'm':
+        v *= 1e6, end++;
+        break;
+    case 'g':
+        v *= 1e9, end++;
+        break;
+    }
+    return end == str || *end || v < 0 ? -1 : v;
+}
 
 static void config(int argc, char** argv)
 {
-    char fname[1024];
+    char fname[1024], desc[256];
     int i, opt;
+    int profile = 0, rate = 0, delay = -1, queue = 0;
+    const char* errors = "ber";
+    const char* replay = NULL;
+    struct REC_INFO info;
+    int ttl = 0, mesh = 0;
+    double v;
 
     if (argc < 2) {
     usage:
-        printf("\nUsage:\n  %s <options> <station-name>\n", argv[0]);
+        printf("\nUsage:\n  %s <options> <station-name>\n  %s --launch <options>\n  %s --virtual|--pair <options>\n  %s --replay=<file> <options>\n",
+            argv[0], argv[0], argv[0], argv[0]);
         printf(
             "\nOptions : \n"
             "    -?, --help : print this\n"
             "    -u, --utopia : utopia channel (an error-free channel)\n"
-            "    -f, --flood : flood traffic\n"
+            "    -f, --flood : flood traffic, same as --traffic=flood\n"
+            "    -m, --traffic=<model> : network layer source (default: legacy)\n"
+            "          legacy : about 3/4 of line rate, BUSY/IDLE periods at station B\n"
+            "          cbr:<load>, poisson:<load> : fixed or exponential gaps, load 0.5 = 50%% of line rate\n"
+            "          onoff:<load>[,<on_ms>[,<alpha>]] : Pareto bursts at line rate (default: 1000 ms, 1.5)\n"
+            "          trace:<file> : \"<ms> [<bytes>]\" per line, played once\n"
             "    -i, --ibib  : set station B layer 3 sender mode as IDLE-BUSY-IDLE-BUSY-...\n"
             "    -n, --nolog : do not create log file\n"
             "    -d, --debug=<0-7>: debug mask (bit0:event, bit1:frame, bit2:warning)\n"
             "    -p, --port=<port#> : TCP port number (default: %u)\n"
             "    -b, --ber=<ber> : Bit Error Rate (received data only)\n"
-            "    -l, --log=<filename> : using assigned file as log file\n"
+            "    -e, --errors=<model> : bit-error model (default: ber)\n"
+            "          ber : independent errors at the --ber rate\n"
+            "          ge:<p>,<r>,<ber_bad>[,<ber_good>] : Gilbert-Elliott bursts, p/r per bit\n"
+            "          trace:<file> : XOR masks of successive line bytes, looped\n"
+            "    -N, --netem=<list> : frame impairments, comma separated (default: none)\n"
+            "          jitter=<ms>[:uniform|normal|pareto] : delay variation around --delay\n"
+            "          loss=<p>, dup=<p> : frames dropped or duplicated, %% suffix allowed\n"
+            "          reorder : let jittered frames overtake each other\n"
+            "    -l, --log=<filename> : using assigned file as log file (-A/-B added by --launch)\n"
             "    -t, --ttl=<seconds> : set time-to-live\n"
+            "    -s, --seed=<n> : seed of payload, noise and traffic (default: 0x%08x)\n"
+            "    -c, --code=<nibble|cobs> : physical layer line code (default: nibble)\n"
+            "    -v, --virtual : run station A and B in this process on a virtual clock\n"
+            "    -P, --pair : run station A and B in this process in real time\n"
+            "    -L, --launch : run station A and B as processes forked over a socket pair\n"
+            "    -W, --switch=<n>[:mesh] : n stations in this process joined by a switch, A with\n"
+            "          each of the others, or each with each (default: --virtual clock)\n"
+            "    -F, --fabric=<bps> : switch fabric rate, k/M/G suffix allowed (default: non-blocking)\n"
+            "    -T, --transport=<tcp|shm|uring> : line between station processes (default: tcp)\n"
+            "    -I, --io-thread : run the line, pacer and reassembly on a thread of their own\n"
+            "    -H, --realtime=<list> : low-jitter station process, comma separated (default: off)\n"
+            "          fifo[=<prio>] or nice=<n> : SCHED_FIFO priority (default: 50) or nice level\n"
+            "          cpu=<n>[+<m>] : run on CPU n, the I/O thread on CPU m\n"
+            "          lock : lock memory against paging\n"
+            "          spin=<us> : busy-poll the line that long before a deadline instead of sleeping\n"
+            "    -C, --channel=<classic|satellite|wan|lan> : channel profile (default: classic)\n"
+            "    -r, --rate=<bps> : line rate, k/M/G suffix allowed (default: %d)\n"
+            "    -D, --delay=<ms> : propagation delay (default: %d)\n"
+            "    -q, --queue=<bytes> : physical layer sending queue, k/M suffix allowed\n"
+            "    -S, --schedule=<file> : per-direction rate, delay and ber changes over time\n"
+            "    -R, --record=<file> : record received line bytes and sent frames (-A/-B added in-process)\n"
+            "    -X, --replay=<file> : feed a recording to the station it was made by, no peer\n"
             "\n"
             "i.e.\n"
             "    %s -fd3 -b 1e-4 A\n"
             "    %s --flood --debug=3 --ber=1e-4 A\n"
             "\n",
-            DEFAULT_PORT, argv[0], argv[0]);
+            DEFAULT_PORT, mode_seed, DEFAULT_CHAN_BPS, DEFAULT_CHAN_DELAY, argv[0], argv[0]);
         exit(0);
     }
 
@@ -173,6 +768,9 @@ static void config(int argc, char** argv)
     SetConsoleTitle(fname);
 #endif
     strcpy(fname, "");
+#ifndef _WIN32
+    rt_init(&rt_cfg);
+#endif
 
     while ((opt = getopt_long(argc, argv, OPT_SHORT, intopts, NULL)) != -1) {
         switch (opt) {
@@ -181,6 +779,7 @@ static void config(int argc, char** argv)
 
         case 'u':
             ber = 0.0;
+            errors = "ber";
             break;
 
         case 'f':
@@ -203,6 +802,23 @@ static void config(int argc, char** argv)
             port = (unsigned short)atoi(optarg);
             break;
 
+        case 'e':
+            errors = optarg;
+            break;
+
+        case 'N':
+            /* impairments add up, so the recorded list is all of them in turn */
+            if (ne_parse(&ne_cfg, optarg) < 0 || strlen(ne_spec) + strlen(optarg) + 1 >= sizeof(ne_spec)) {
+                printf("Bad impairments \"%s\"\n", optarg);
+                goto usage;
+            }
+            sprintf(ne_spec + strlen(ne_spec), "%s%s", ne_spec[0] ? "," : "", optarg);
+            break;
+
+        case 's':
+            mode_seed = (unsigned int)strtoul(optarg, NULL, 0);
+            break;
+
         case 'b':
             ber = strtod(optarg, 0);
             if (ber >= 1.0) {
@@ -217,69 +833,456 @@ static void config(int argc, char** argv)
 
         case 't':
             mode_life = atoi(optarg) * 1000; /* ms */
+            ttl = 1;
             break;
 
-        default:
-            printf("ERROR: Unsupported option\n");
+        case 'c':
+            if ((linecode = lc_lookup(optarg)) < 0) {
+                printf("Bad line code \"%s\"\n", optarg);
+                goto usage;
+            }
+            line_bits = lc_bits(linecode);
+            break;
+
+        case 'v':
+        case 'P':
+#ifdef _WIN32
+            printf("In-process stations are not supported on Windows\n");
             goto usage;
-        }
-    }
+#else
+            mode_local = opt == 'v' ? LOCAL_VIRTUAL : LOCAL_PAIR;
+            break;
+#endif
 
-    if (optind == argc)
-        goto usage;
+        case 'C':
+            for (i = 0; i < (int)(sizeof(chan_profiles) / sizeof(chan_profiles[0])); i++) {
+                if (stricmp(optarg, chan_profiles[i].name) == 0)
+                    break;
+            }
+            if (i == sizeof(chan_profiles) / sizeof(chan_profiles[0])) {
+                printf("Bad channel profile \"%s\"\n", optarg);
+                goto usage;
+            }
+            profile = i;
+            break;
 
-    station = tolower(argv[optind++][0]);
-    if (station != 'a' && station != 'b')
-        ABORT("Station name must be 'A' or 'B'");
+        case 'r':
+            if ((v = parse_count(optarg)) < 100 || v > 1e9) {
+                printf("Bad line rate \"%s\"\n", optarg);
+                goto usage;
+            }
+            rate = (int)v;
+            break;
 
-    if (fname[0] == 0) {
-        strcpy(fname, argv[0]);
-        if (stricmp(fname + strlen(fname) - 4, ".exe") == 0)
-            *(fname + strlen(fname) - 4) = 0;
-        strcat(fname, station == 'a' ? "-A.log" : "-B.log");
-    }
+        case 'D':
+            if ((delay = atoi(optarg)) < 0 || delay > 60000) {
+                printf("Bad delay \"%s\"\n", optarg);
+                goto usage;
+            }
+            break;
 
-    if (stricmp(fname, "nul") == 0)
-        log_file = NULL;
-    else if ((log_file = fopen(fname, "w")) == NULL)
-        printf("WARNING: Failed to create log file \"%s\": %s\n", fname, strerror(errno));
+        case 'q':
+            if ((v = parse_count(optarg)) < 8192 || v > 1 << 30) {
+                printf("Bad queue size \"%s\"\n", optarg);
+                goto usage;
+            }
+            queue = (int)v;
+            break;
 
-    lprintf(
-        "=============================================================\n"
-        "                    Station %s                               \n"
-        "-------------------------------------------------------------\n",
-        station_name());
+        case 'S':
+            if (strlen(optarg) >= sizeof(sch_name)) {
+                printf("Bad schedule \"%s\"\n", optarg);
+                goto usage;
+            }
+            strcpy(sch_name, optarg);
+            break;
 
-    lprintf("Protocol.lib, version %s, jiangyanjun0718@bupt.edu.cn\n", VERSION, __DATE__);
-    lprintf("Channel: %d bps, %d ms propagation delay, bit error rate ", CHAN_BPS, CHAN_DELAY);
-    if (ber > 0.0)
-        lprintf("%.1E\n", ber);
-    else
-        lprintf("0\n");
-    lprintf("Log file \"%s\", TCP port %d, debug mask 0x%02x\n", fname, port, debug_mask);
-}
+        case 'm':
+            if (strlen(optarg) >= sizeof(tm_spec)) {
+                printf("Bad traffic model \"%s\"\n", optarg);
+                goto usage;
+            }
+            strcpy(tm_spec, optarg);
+            break;
 
-/* Create Communication Sockets  */
+        case 'W':
+#ifdef _WIN32
+            printf("In-process stations are not supported on Windows\n");
+            goto usage;
+#else
+            mode_switch = atoi(optarg);
+            if (mode_switch < 2 || mode_switch > 26 || (strchr(optarg, ':') && stricmp(strchr(optarg, ':'), ":mesh") != 0)) {
+                printf("Bad switch \"%s\"\n", optarg);
+                goto usage;
+            }
+            mesh = strchr(optarg, ':') != NULL;
+            nsession = mesh ? mode_switch * (mode_switch - 1) / 2 : mode_switch - 1;
+            break;
+#endif
 
-void protocol_init(int argc, char** argv)
-{
-    int admin_sock, i;
-    struct sockaddr_in name;
+        case 'F':
+            if ((v = parse_count(optarg)) < 100 || v > 2e9) {
+                printf("Bad fabric rate \"%s\"\n", optarg);
+                goto usage;
+            }
+            fabric_bps = (int)v;
+            break;
 
-    socket_init();
-    magic_init();
+        case 'R':
+            rec_name = optarg;
+            break;
 
-    config(argc, argv);
+        case 'I':
+#ifdef _WIN32
+            printf("The I/O thread is not supported on Windows\n");
+            goto usage;
+#else
+            io_thread = 1;
+            break;
+#endif
 
-    if (station == 'a') {
+        case 'H':
+#ifdef _WIN32
+            printf("The real-time mode is not supported on Windows\n");
+            goto usage;
+#else
+            if (rt_parse(&rt_cfg, optarg) < 0) {
+                printf("Bad real-time settings \"%s\"\n", optarg);
+                goto usage;
+            }
+            break;
+#endif
 
-        srand(mode_seed ^ 97209);
+        case 'L':
+#ifdef _WIN32
+            printf("The launcher is not supported on Windows\n");
+            goto usage;
+#else
+            mode_launch = 1;
+            break;
+#endif
 
-        name.sin_family = AF_INET;
-        name.sin_addr.s_addr = INADDR_ANY;
-        name.sin_port = htons(port);
+        case 'X':
+            replay = optarg;
+            break;
 
-        admin_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        case 'T':
+            if (stricmp(optarg, "tcp") == 0)
+                phl = &tcp_ops;
+#ifndef _WIN32
+            else if (stricmp(optarg, "shm") == 0)
+                phl = &shm_ops;
+            else if (stricmp(optarg, "uring") == 0) {
+                /* connected as TCP, the station switches over once the socket is there */
+                phl = &tcp_ops;
+                mode_uring = 1;
+            }
+#endif
+            else {
+                printf("Bad transport \"%s\"\n", optarg);
+                goto usage;
+            }
+            break;
+
+        default:
+            printf("ERROR: Unsupported option\n");
+            goto usage;
+        }
+    }
+
+    em_cfg.ber = ber;
+    if (em_parse(&em_cfg, errors) < 0) {
+        printf("Bad error model \"%s\"\n", errors);
+        goto usage;
+    }
+
+    if (mode_switch) {
+        int a, b, k = 0;
+
+        if ((sessions = (unsigned char (*)[2])malloc(nsession * sizeof(sessions[0]))) == NULL)
+            ABORT("No enough memory");
+        for (a = 0; a < mode_switch; a++) {
+            for (b = a + 1; b < mode_switch; b++) {
+                if (a == 0 || mesh) {
+                    sessions[k][0] = (unsigned char)a;
+                    sessions[k++][1] = (unsigned char)b;
+                }
+            }
+        }
+        if (!mode_local)
+            mode_local = LOCAL_VIRTUAL;
+    }
+
+    if (replay) {
+        if (mode_local) {
+            printf("A replay runs one station\n");
+            goto usage;
+        }
+        if (rec_open(&rec_in, replay, &info) < 0 || rec_open(&rec_tx, replay, &info) < 0) {
+            printf("Bad recording \"%s\"\n", replay);
+            goto usage;
+        }
+
+        /* the station, its line and its traffic as recorded */
+        mode_replay = 1;
+        phl = &replay_ops;
+        linecode = info.linecode;
+        line_bits = lc_bits(linecode);
+        rate = info.bps;
+        delay = info.delay;
+        mode_tick = info.tick;
+        mode_seed = info.seed;
+        mode_flood = info.flood;
+        mode_ibib = info.ibib;
+        queue = info.queue;
+        if (!ttl)
+            mode_life = info.life;
+
+        /* and its impairments, schedule and traffic model, in place of any given now */
+        memset(&ne_cfg, 0, sizeof(ne_cfg));
+        if (info.netem[0] && ne_parse(&ne_cfg, info.netem) < 0) {
+            printf("Bad impairments \"%s\" in the recording\n", info.netem);
+            goto usage;
+        }
+        strcpy(ne_spec, info.netem);
+        strcpy(sch_name, info.schedule);
+        strcpy(tm_spec, info.traffic);
+    }
+
+    if (sch_name[0] && (i = sch_load(&sched, sch_name)) != 0) {
+        if (i < 0)
+            printf("Failed to read schedule \"%s\"\n", sch_name);
+        else
+            printf("Bad schedule \"%s\", line %d\n", sch_name, i);
+        goto usage;
+    }
+
+    if (mode_launch && (mode_local || mode_replay || phl != &tcp_ops)) {
+        printf("The launcher joins two station processes over a socket pair, --transport=tcp or uring\n");
+        goto usage;
+    }
+
+#ifndef _WIN32
+    if (rt_cfg.active && (mode_local || mode_replay)) {
+        printf("The real-time mode serves a station process on the real clock\n");
+        goto usage;
+    }
+#endif
+
+    if (io_thread && (mode_local || mode_replay)) {
+        printf("The I/O thread serves a station process on a TCP or shm line\n");
+        goto usage;
+    }
+
+#ifndef _WIN32
+    /* the I/O thread takes the CPU of the protocol thread unless given one, and could not run while it spins */
+    if (io_thread && rt_cfg.fifo && rt_cfg.spin && rt_cfg.cpu[0] >= 0 && (rt_cfg.cpu[1] < 0 || rt_cfg.cpu[1] == rt_cfg.cpu[0])) {
+        printf("A spinning SCHED_FIFO protocol thread needs the I/O thread on a CPU of its own, cpu=<n>+<m>\n");
+        goto usage;
+    }
+#endif
+
+    if (tm_spec[0] && tm_parse(&tm_cfg, tm_spec, PKT_LEN) < 0) {
+        printf("Bad traffic model \"%s\"\n", tm_spec);
+        goto usage;
+    }
+    if (tm_cfg.model == TM_FLOOD)
+        mode_flood = 1;
+    else if (mode_flood)
+        tm_cfg.model = TM_FLOOD;
+
+    chan_bps = rate ? rate : chan_profiles[profile].bps;
+    chan_delay = delay >= 0 ? delay : chan_profiles[profile].delay;
+    sq_size = queue ? queue : chan_profiles[profile].queue;
+
+    /*
+     * Sending queue watermarks: ready below two pacer slots of line bytes,
+     * so the datalink refills it before the line idles, and the network
+     * layer held above a propagation delay more, which bounds the delay
+     * the queue adds to about that.
+     */
+    i = mode_tick > line_bits * 1000 / chan_bps ? mode_tick : (line_bits * 1000 + chan_bps - 1) / chan_bps;
+    sq_low = (int)((long long)2 * i * chan_bps / line_bits / 1000);
+    if (sq_low < PHL_SQ_LEVEL)
+        sq_low = PHL_SQ_LEVEL;
+    sq_high = sq_low + (int)((long long)chan_delay * chan_bps / line_bits / 1000);
+    if (sq_high < sq_low + 4 * lc_bound(linecode, PKT_LEN + 8))
+        sq_high = sq_low + 4 * lc_bound(linecode, PKT_LEN + 8);
+    if (sq_high > sq_size / 2)
+        sq_high = sq_size / 2;
+    if (sq_low > sq_high / 2)
+        sq_low = sq_high / 2;
+
+    /* bytes are committed early enough for the earliest frame the jitter allows */
+    chan_lead = ne_lead(&ne_cfg);
+    if (chan_lead > chan_delay - COMMIT_SLACK)
+        chan_lead = chan_delay - COMMIT_SLACK;
+
+    /* 16 ticks of 8-bit bytes as before, within reason on fast lines */
+    blk_size = 16 * (chan_bps / 8) / (1000 / DEFAULT_TICK);
+    if (blk_size < 64)
+        blk_size = 64;
+    if (blk_size > 4096)
+        blk_size = 4096;
+
+    if (mode_local) {
+        /* this thread is station A, station B gets a thread of its own */
+        station = 'a';
+        log_tag = station_name;
+    } else if (mode_replay)
+        station = info.station;
+#ifndef _WIN32
+    else if (mode_launch) {
+        /* both stations write to this terminal */
+        station = launch();
+        log_tag = station_name;
+    }
+#endif
+    else {
+        if (optind == argc)
+            goto usage;
+
+        station = tolower(argv[optind++][0]);
+        if (station != 'a' && station != 'b')
+            ABORT("Station name must be 'A' or 'B'");
+    }
+
+    if (fname[0] == 0) {
+        strcpy(fname, argv[0]);
+        if (stricmp(fname + strlen(fname) - 4, ".exe") == 0)
+            *(fname + strlen(fname) - 4) = 0;
+        strcat(fname, mode_local ? "-AB.log" : station == 'a' ? "-A.log" : "-B.log");
+    } else if (mode_launch && stricmp(fname, "nul") != 0) {
+        /* "run.log" to "run-A.log", as a recording */
+        const char* ext = strrchr(fname, '.');
+        int n = ext && !strpbrk(ext, "/\\") ? (int)(ext - fname) : (int)strlen(fname);
+        char path[1024];
+
+        sprintf(path, "%.*s-%s%.16s", n < 1000 ? n : 1000, fname, station_name(), fname + n);
+        strcpy(fname, path);
+    }
+
+    if (stricmp(fname, "nul") == 0)
+        log_file = NULL;
+    else if ((log_file = fopen(fname, "w")) == NULL)
+        printf("WARNING: Failed to create log file \"%s\": %s\n", fname, strerror(errno));
+
+    if (mode_switch)
+        sprintf(desc, "A to %c, switched", 'A' + mode_switch - 1);
+    lprintf(
+        "=============================================================\n"
+        "                    Station %s                               \n"
+        "-------------------------------------------------------------\n",
+        mode_switch ? desc : mode_local == LOCAL_VIRTUAL ? "A & B, virtual time" : mode_local ? "A & B, in-process" : station_name());
+
+    lprintf("Protocol.lib, version %s, jiangyanjun0718@bupt.edu.cn\n", VERSION, __DATE__);
+    lprintf("Channel: %d bps, %d ms propagation delay, %d-byte queue, bit error rate ", chan_bps, chan_delay, sq_size);
+    if (em_cfg.model != EM_NONE)
+        lprintf("%.1E\n", em_expected(&em_cfg, line_bits));
+    else
+        lprintf("0\n");
+    lprintf("Bit errors: %s\n", em_describe(&em_cfg, desc));
+    lprintf("Impairments: %s\n", ne_describe(&ne_cfg, desc));
+    if (sch_name[0])
+        lprintf("Schedule: %d changes from \"%s\"\n", sched.n, sch_name);
+    lprintf("Sending queue: ready below %d bytes, network layer held from %d, %d at most\n", sq_low, sq_high, sq_size);
+    lprintf("Line code: %s, %s kernels\n", lc_name(linecode), lc_init());
+    lprintf("Payload: counter-based, %s kernels\n", pl_init());
+    lprintf("Traffic: %s\n", tm_describe(&tm_cfg, desc));
+    lprintf("Transport: %s%s\n", mode_switch ? "memory, through the switch" : mode_local ? "memory" : mode_uring ? "TCP over io_uring" : phl->name,
+        io_thread ? ", on an I/O thread" : "");
+#ifndef _WIN32
+    if (rt_cfg.active)
+        lprintf("Real-time: %s\n", rt_describe(&rt_cfg, desc));
+#endif
+    if (replay)
+        lprintf("Replay: \"%s\", station %s as recorded\n", replay, station_name());
+    if (rec_name)
+        lprintf("Record: \"%s\"\n", rec_name);
+    lprintf("Log file \"%s\", TCP port %d, debug mask 0x%02x, seed 0x%08x\n", fname, port, debug_mask, mode_seed);
+}
+
+/* Create Communication Sockets  */
+
+#ifndef _WIN32
+static int sim_argc;
+static char** sim_argv;
+
+extern int main(int argc, char** argv);
+
+/* The other session ends of an in-process run are the same program on threads of their own */
+static void* sim_station(void* arg)
+{
+    int idx = (int)(long)arg;
+
+    session = idx / 2;
+    station = 'a' + idx % 2;
+    main(sim_argc, sim_argv);
+    return arg;
+}
+#endif
+
+void protocol_init(int argc, char** argv)
+{
+    int admin_sock, i, ms;
+    struct sockaddr_in name;
+#ifndef _WIN32
+    char name_buf[128];
+    const char* refused;
+#endif
+
+#ifndef _WIN32
+    /* the other ends of an in-process run, started by station A below */
+    if (station) {
+        sc_enter(SIM_ME);
+        phl_init();
+        nl_init();
+        get_ms();
+        return;
+    }
+#endif
+
+    socket_init();
+    magic_init();
+
+    config(argc, argv);
+
+#ifndef _WIN32
+    if (mode_local) {
+        pthread_t tid;
+
+        sc_init(2 * nsession, mode_local == LOCAL_PAIR);
+        if (mode_switch)
+            sw_init(2 * nsession, chan_bps, fabric_bps, sq_size, linecode, line_bits);
+        phl = &sim_ops;
+        sim_argc = argc;
+        sim_argv = argv;
+        for (i = 1; i < 2 * nsession; i++) {
+            if (pthread_create(&tid, NULL, sim_station, (void*)(long)i) != 0)
+                ABORT("Create thread for station B");
+        }
+        sc_enter(0);
+
+        if (mode_switch)
+            lprintf("%d stations in this process, %d sessions through a switch, %s fabric\n",
+                mode_switch, nsession, fabric_bps ? "shared" : "non-blocking");
+        else
+            lprintf("Station B runs in this process, line bytes travel in memory\n");
+    }
+#endif
+
+#ifndef _WIN32
+    if (phl == &shm_ops)
+        shm_connect();
+#endif
+
+    if (station == 'a' && phl == &tcp_ops && !mode_launch) {
+
+        name.sin_family = AF_INET;
+        name.sin_addr.s_addr = INADDR_ANY;
+        name.sin_port = htons(port);
+
+        admin_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
         if (admin_sock < 0)
             ABORT("Create TCP socket");
         if (bind(admin_sock, (struct sockaddr*)&name, sizeof(name)) < 0) {
@@ -297,12 +1300,10 @@ void protocol_init(int argc, char** argv)
             ABORT("Station A failed to communicate with station B");
         lprintf("Done.\n");
 
-        recv(sock, (char*)&epoch, sizeof(epoch), 0);
+        recv(sock, (char*)&epoch_us, sizeof(epoch_us), 0);
     }
 
-    if (station == 'b') {
-
-        srand(mode_seed ^ 18231);
+    if (station == 'b' && phl == &tcp_ops && !mode_launch) {
 
         sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
         if (sock < 0)
@@ -312,38 +1313,44 @@ void protocol_init(int argc, char** argv)
         name.sin_addr.s_addr = inet_addr("127.0.0.1");
         name.sin_port = htons((short)port);
 
-        for (i = 0; i < 60; i++) {
+        /* retry soon while station A is still starting, every 2 seconds after that */
+        for (i = 0, ms = 10; i < 60; i++, ms = ms < 1000 ? 2 * ms : 2000) {
             lprintf("Station B is connecting station A (TCP port %u) ... ", port);
             fflush(stdout);
 
             if (connect(sock, (struct sockaddr*)&name, sizeof(struct sockaddr_in)) < 0) {
                 lprintf("Failed!\n");
-                Sleep(2000);
+                Sleep(ms);
             } else {
                 lprintf("Done.\n");
                 break;
             }
         }
-        if (i == 6)
+        if (i == 60)
             ABORT("Station B failed to connect station A");
 
-        time(&epoch);
-        send(sock, (char*)&epoch, sizeof(epoch), 0);
+        /* the stations share a machine, so they share its monotonic clock too */
+        epoch_us = clock_us();
+        send(sock, (char*)&epoch_us, sizeof(epoch_us), 0);
     }
 
     {
         struct tm* newtime;
+        time(&epoch);
         newtime = localtime(&epoch);
         lprintf("New epoch: %s", asctime(newtime));
         lprintf("=================================================================\n\n");
     }
 
     /* socket options */
-    {
+    if (phl == &tcp_ops) {
         int timeout_ms = 10;
-        int buf_size = 1024 * 64;
+        int buf_size = (int)((long long)2 * mode_tick * chan_bps / line_bits / 1000); /* two ticks of line bytes */
         int on = 1;
 
+        if (buf_size < 1024 * 64)
+            buf_size = 1024 * 64;
+
         setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, (char*)&timeout_ms, sizeof(int));
         setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (char*)&timeout_ms, sizeof(int));
 
@@ -353,241 +1360,817 @@ void protocol_init(int argc, char** argv)
         setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (char*)&on, sizeof(on));
     }
 
+#ifndef _WIN32
+    if (rt_cfg.active && (refused = rt_apply(&rt_cfg, 0, name_buf)) != NULL)
+        lprintf("Real-time: refused %s, running without\n", refused);
+    if (io_thread)
+        io_start();
+    else
+#endif
+        phl_init();
+    nl_init();
+
     get_ms();
 }
 
+/* Object Pools: fixed-size objects recycled through a free list, grown in chunks */
+
+struct POOL {
+    const char* name;
+    int size; /* object size */
+    int chunk; /* objects added per growth */
+    void* free_list;
+    int nobj, nused, hiwater, ngrow;
+};
+
+static void pool_grow(struct POOL* pool, int n)
+{
+    char* mem;
+    int i;
+
+    if ((mem = (char*)malloc((size_t)pool->size * n)) == NULL)
+        ABORT("No enough memory");
+
+    for (i = 0; i < n; i++) {
+        *(void**)(mem + (size_t)pool->size * i) = pool->free_list;
+        pool->free_list = mem + (size_t)pool->size * i;
+    }
+    pool->nobj += n;
+    pool->ngrow++;
+}
+
+static void pool_init(struct POOL* pool, const char* name, int size, int n)
+{
+    memset(pool, 0, sizeof(*pool));
+    pool->name = name;
+    pool->size = size < (int)sizeof(void*) ? (int)sizeof(void*) : size;
+    pool->chunk = n;
+    pool_grow(pool, n);
+    pool->ngrow = 0;
+}
+
+static void* pool_get(struct POOL* pool)
+{
+    void* obj;
+
+    if (pool->free_list == NULL)
+        pool_grow(pool, pool->chunk);
+
+    obj = pool->free_list;
+    pool->free_list = *(void**)obj;
+    if (++pool->nused > pool->hiwater)
+        pool->hiwater = pool->nused;
+    return obj;
+}
+
+static void pool_put(struct POOL* pool, void* obj)
+{
+    *(void**)obj = pool->free_list;
+    pool->free_list = obj;
+    pool->nused--;
+}
+
+static void pool_report(struct POOL* pool)
+{
+    lprintf("Pool %s: high water %d of %d, grown %d times\n",
+        pool->name, pool->hiwater, pool->nobj, pool->ngrow);
+}
+
 /* Physical Layer: Sender */
 
-/* Sending queue structure */
+/* Sending queue structure: a ring grown on demand, sq_size bytes at most */
+
+static STATION_LOCAL unsigned char* sq; /* sq_cap bytes */
+static STATION_LOCAL int sq_cap, sq_head, sq_tail;
+static STATION_LOCAL int inform_phl_ready = 1;
+static STATION_LOCAL unsigned int sq_ngrow, sq_drops;
+
+#define sq_inc(p, n) (p = (p + n) % sq_cap)
+
+/* line bytes of each frame in the queue, oldest first and less what of it has gone out */
+static STATION_LOCAL int* sq_flen;
+static STATION_LOCAL int sq_fcap, sq_fhead, sq_fn;
+
+#define sq_fnext() (sq_fn ? sq_flen[sq_fhead] : 0)
+
+/* depth histogram: microseconds spent empty, then below each power of 2 */
+#define SQ_HIST 32
 
-#define SQ_SIZE (128 * 1024)
+static STATION_LOCAL long long sq_hist[SQ_HIST], sq_hist_us, sq_high_us;
 
-static unsigned char sq[SQ_SIZE];
-static int sq_head, sq_tail;
-static int inform_phl_ready = 1;
+/*
+ * Token bucket: tokens are bit-microseconds, elapsed time adds tx_bps
+ * per microsecond and a line byte costs SEND_COST, so no rate rounds to
+ * zero and no remainder is lost between flushes.
+ */
+static STATION_LOCAL long long send_tokens = 0;
+static STATION_LOCAL long long send_last_us = 0; /* when tokens were last credited */
+static STATION_LOCAL int sq_stalled = 0; /* last flush was cut short, wait for the socket to drain */
 
-#define sq_inc(p, n) (p = (p + n) % SQ_SIZE)
+#define SEND_COST (line_bits * 1000000LL)
 
-static int send_bytes_allowed = 0;
+/* rate slot: the pacer flushes once per tick, or per byte on slow lines */
+#define SEND_SLOT_MS (mode_tick > line_bits * 1000 / tx_bps ? mode_tick : (line_bits * 1000 + tx_bps - 1) / tx_bps)
+
+/* bucket depth, one slot worth of line bytes */
+#define SEND_BURST ((int)((long long)SEND_SLOT_MS * tx_bps / line_bits / 1000))
+
+/* what a flush waits to have paid for: a slot, or the oldest frame whole when it takes longer than that */
+#define SEND_BATCH (sq_fnext() > SEND_BURST ? sq_fnext() : SEND_BURST)
+
+/* longest frame the physical layer carries */
+#define MAX_FRAME 2048
+
+/* syscall accounting of the physical layer */
+static STATION_LOCAL unsigned int nsys_send, nsys_recv, nsys_wait;
+static STATION_LOCAL unsigned long long nline_sent, nline_recv; /* line bytes */
 
 static int sq_len(void)
 {
-    return (sq_tail + SQ_SIZE - sq_head) % SQ_SIZE;
+    return (sq_tail + sq_cap - sq_head) % sq_cap;
+}
+
+/* Charge the time since the last change of depth to the depth the queue had */
+static void sq_sample(void)
+{
+    long long us = get_us(), dt = us - sq_hist_us;
+    int n = sq_len(), b;
+
+    if (sq_hist_us && dt > 0) {
+        for (b = 0; n >> b; b++)
+            ;
+        sq_hist[b] += dt;
+        if (n >= sq_high)
+            sq_high_us += dt;
+    }
+    sq_hist_us = us;
+}
+
+/* Note a frame of 'n' line bytes queued */
+static void sq_frame_in(int n)
+{
+    int* p;
+
+    if (sq_fn == sq_fcap) {
+        if ((p = (int*)realloc(sq_flen, (sq_fcap ? 2 * (size_t)sq_fcap : 64) * sizeof(int))) == NULL)
+            ABORT("No enough memory");
+        /* a full ring wraps at sq_fhead: the part before it moves past the old end */
+        memcpy(p + sq_fcap, p, sq_fhead * sizeof(int));
+        sq_flen = p;
+        sq_fcap = sq_fcap ? 2 * sq_fcap : 64;
+    }
+    sq_flen[(sq_fhead + sq_fn++) % sq_fcap] = n;
+}
+
+/* Take 'n' bytes sent off the frames they belong to */
+static void sq_frame_out(int n)
+{
+    int k;
+
+    while (n > 0 && sq_fn) {
+        k = n < sq_flen[sq_fhead] ? n : sq_flen[sq_fhead];
+        n -= k;
+        if ((sq_flen[sq_fhead] -= k) == 0) {
+            sq_fhead = (sq_fhead + 1) % sq_fcap;
+            sq_fn--;
+        }
+    }
+}
+
+/* Make room for 'n' more bytes, growing the ring up to sq_size; 0 if the queue is full */
+static int sq_room(int n)
+{
+    int cap, len = sq_len(), part;
+    unsigned char* p;
+
+    if (len + n <= sq_cap - 1)
+        return 1;
+    if (len + n > sq_size - 1)
+        return 0;
+
+    for (cap = sq_cap; len + n > cap - 1; cap *= 2)
+        ;
+    if (cap > sq_size)
+        cap = sq_size;
+    if ((p = (unsigned char*)realloc(sq, cap)) == NULL)
+        return 0;
+
+    /* a wrapped queue: the part up to the old end moves to the new end */
+    if (sq_tail < sq_head) {
+        part = sq_cap - sq_head;
+        memmove(p + cap - part, p + sq_head, part);
+        sq_head = cap - part;
+    }
+    sq = p;
+    sq_cap = cap;
+    sq_ngrow++;
+#ifndef _WIN32
+    if (phl == &uring_ops && ur_register(sq, sq_cap) < 0)
+        lprintf("io_uring: the grown sending queue could not be registered, plain sends\n");
+#endif
+    return 1;
 }
 
 int phl_sq_len(void)
 {
+#ifndef _WIN32
+    /* frames still in the ring count at their raw length, line code aside */
+    if (io_thread && !io_self)
+        return (int)(__atomic_load_n(&io_sq, __ATOMIC_ACQUIRE) + spsc_used(&io_tx));
+#endif
     return sq_len();
 }
 
-static void send_byte(unsigned char byte)
+static void socket_send(void);
+static void send_credit(void);
+static void rec_frame(const unsigned char* frame, int len);
+
+#ifndef _WIN32
+static void io_kick(void);
+#endif
+
+/* Line-code a frame into the sending queue, the wire side of send_frame() */
+static void phl_send(const unsigned char* frame, int len)
 {
-    inform_phl_ready = 1;
+    static STATION_LOCAL unsigned char line[MAX_FRAME * 2 + 2];
+    int n, n1;
+
+    if (rec_out.fp || mode_replay)
+        rec_frame(frame, len);
+
+    /* an idle line banks no more than a slot, whatever the frame that ends it */
+    if (sq_len() == 0)
+        send_credit();
 
-    if (send_bytes_allowed && sq_head == sq_tail) {
-        send(sock, (char*)&byte, 1, 0);
-        send_bytes_allowed--;
+    n = lc_encode(linecode, frame, len, line);
+    if (!sq_room(n)) {
+        /* back-pressure, not a failure: the datalink recovers the frame as it would one lost on the line */
+        sq_drops++;
+        dbg_warning("Sending queue full, %d-byte frame dropped\n", len);
         return;
     }
+    sq_sample();
 
-    if (sq_len() == SQ_SIZE - 1)
-        ABORT("Physical Layer Sending Queue overflow");
+    n1 = sq_cap - sq_tail;
+    if (n <= n1)
+        memcpy(&sq[sq_tail], line, n);
+    else {
+        memcpy(&sq[sq_tail], line, n1);
+        memcpy(sq, line + n1, n - n1);
+    }
+    sq_inc(sq_tail, n);
+    sq_frame_in(n);
 
-    sq[sq_tail] = byte;
-    sq_inc(sq_tail, 1);
+    /* the whole frame goes out in one write if credit is left over */
+    if (send_tokens >= SEND_COST && !sq_stalled)
+        socket_send();
 }
 
 void send_frame(unsigned char* frame, int len)
 {
-    int i;
+    if (len > MAX_FRAME)
+        ABORT("send_frame(): frame too long");
 
-    send_byte(0xff);
+    inform_phl_ready = 1;
 
-    for (i = 0; i < len; i++) {
-        send_byte(frame[i] & 0x0f);
-        send_byte((frame[i] & 0xf0) >> 4);
+#ifndef _WIN32
+    if (io_thread) {
+        if (!spsc_push(&io_tx, frame, len)) {
+            __atomic_add_fetch(&io_drops, 1, __ATOMIC_RELAXED);
+            dbg_warning("Sending queue full, %d-byte frame dropped\n", len);
+            return;
+        }
+        io_kick();
+        return;
     }
-    send_byte(0xff);
+#endif
+    phl_send(frame, len);
 }
 
-static int send_sq_data(unsigned int start, unsigned int end1)
+/* The peer hung up: quitting first at the end of a run, which ends this one too; a failure before */
+static void phl_hangup(void)
 {
-    int ret;
+    if (now < mode_life - COMMIT_SLACK) {
+        lprintf("TCP disconnected.\n");
+        exit(0);
+    }
+#ifndef _WIN32
+    __atomic_store_n(&phl_gone, 1, __ATOMIC_RELEASE);
+#else
+    phl_gone = 1;
+#endif
+}
+
+static int peer_gone(void)
+{
+#ifndef _WIN32
+    return __atomic_load_n(&phl_gone, __ATOMIC_ACQUIRE);
+#else
+    return phl_gone;
+#endif
+}
+
+/* Write 'n' queued bytes from sq_head in a single call */
+static int send_sq_data(int n)
+{
+    int ret, n1 = sq_cap - sq_head;
 
-    if (start >= end1)
+    if (n <= 0)
         return 0;
 
-    ret = send(sock, (char*)&sq[start], end1 - start, 0);
+    ret = phl->send(&sq[sq_head], n < n1 ? n : n1, sq, n < n1 ? 0 : n - n1);
+    nsys_send++;
     if (ret <= 0) {
-        lprintf("TCP Disconnected.\n");
-        exit(0);
+        phl_hangup();
+        return 0;
     }
+    nline_sent += ret;
 
     return ret;
 }
 
-static void socket_send(void)
+/* Credit the time elapsed since the last call at the current rate */
+static void send_credit(void)
 {
-    static int last_ts = 0;
-    int n, send_tail = sq_head, send_bytes;
+    long long us = get_us();
 
-    if (last_ts == 0)
-        last_ts = now;
+    if (send_last_us == 0)
+        send_last_us = us;
 
-    if (now <= last_ts)
-        return;
+    if (us > send_last_us) {
+        send_tokens += (us - send_last_us) * tx_bps;
+        send_last_us = us;
+    }
+
+    /* an idle line does not bank credit for a later burst, a busy one pays for a batch */
+    if (send_tokens > SEND_BATCH * SEND_COST)
+        send_tokens = SEND_BATCH * SEND_COST;
+}
 
-    send_bytes_allowed = (now - last_ts) * CHAN_BPS / 8 / 1000 * 2;
+static void socket_send(void)
+{
+    int n, send_bytes;
+
+    send_credit();
+
+    /* a batch at a time, so a slow line writes once per frame rather than once per slot */
     n = sq_len();
-    if (n > send_bytes_allowed)
-        n = send_bytes_allowed;
-    sq_inc(send_tail, n);
+    if (!sq_stalled && send_tokens < (n < SEND_BATCH ? n : SEND_BATCH) * SEND_COST)
+        return;
+    if (n > send_tokens / SEND_COST)
+        n = (int)(send_tokens / SEND_COST);
 
-    if (send_tail >= sq_head)
-        send_bytes = send_sq_data(sq_head, send_tail);
-    else {
-        send_bytes = send_sq_data(sq_head, SQ_SIZE);
-        send_bytes += send_sq_data(0, send_tail);
-    }
+    send_bytes = send_sq_data(n);
 
+    if (send_bytes > 0)
+        sq_sample();
     sq_inc(sq_head, send_bytes);
-    send_bytes_allowed -= send_bytes;
+    sq_frame_out(send_bytes);
+    send_tokens -= send_bytes * SEND_COST;
+    sq_stalled = send_bytes < n;
+}
 
-    last_ts = now;
+/* earliest time (us) socket_send() has something to put on the line: once a batch or the whole queue is paid for */
+static long long send_deadline(void)
+{
+    long long need;
+    int n = sq_len();
+
+    if (n == 0 || sq_stalled)
+        return LLONG_MAX;
+    if (send_last_us == 0)
+        return now_us;
+
+    if (n > SEND_BATCH)
+        n = SEND_BATCH;
+    if ((need = n * SEND_COST - send_tokens) <= 0)
+        return now_us;
+    return send_last_us + (need + tx_bps - 1) / tx_bps;
 }
 
 /* Physical Layer: Receiver */
 
-#define BLKSIZE (16 * CHAN_BPS / 8 / (1000 / DEFAULT_TICK))
-
 struct BLK {
-    int commit_ts;
+    long long commit_ts; /* us */
     int rptr, wptr;
     struct BLK* link;
-    unsigned char data[BLKSIZE];
+    unsigned char data[]; /* blk_size bytes */
 };
 
-static struct BLK *rblk_head, *rblk_tail;
-static unsigned int nbits;
+static STATION_LOCAL struct BLK *rblk_head, *rblk_tail;
+static STATION_LOCAL struct POOL blk_pool;
+
+/* blocks filled by one vectored receive */
+#define RECV_IOV 16
 
+static STATION_LOCAL struct BLK* rblk_spare[RECV_IOV];
+
+/* noise draws, (0, 1] */
+static double noise_uniform(void)
+{
+    return rng_uniform(&rng_noise);
+}
+
+/* impairment draws, (0, 1] */
+static double netem_uniform(void)
+{
+    return rng_uniform(&rng_netem);
+}
+
+/* Drain the socket into as many blocks as it takes, all committed together */
 static void socket_recv(void)
 {
     struct BLK* blk;
-    unsigned char* p;
+    unsigned char* buf[RECV_IOV];
+    int i, n, nblk, more;
+
+again:
+    for (i = 0; i < RECV_IOV; i++) {
+        if (rblk_spare[i] == NULL)
+            rblk_spare[i] = (struct BLK*)pool_get(&blk_pool);
+        buf[i] = rblk_spare[i]->data;
+    }
+
+    n = phl->recv(buf, RECV_IOV, blk_size);
+    nsys_recv++;
+    if (n == 0)
+        return;
+    if (n < 0) {
+        phl_hangup();
+        return;
+    }
+
+    /* every block filled, fast lines may have more waiting */
+    more = n == RECV_IOV * blk_size;
+    nline_recv += n;
+
+    for (nblk = 0; n > 0; nblk++, n -= blk_size) {
+        blk = rblk_spare[nblk];
+        rblk_spare[nblk] = NULL;
+
+        blk->rptr = 0;
+        blk->wptr = n < blk_size ? n : blk_size;
+        if (rx_em.model != EM_NONE && (i = em_apply(&em, blk->data, blk->wptr, line_bits)) != 0)
+            dbg_warning("Impose %d bit errors on received data, %llu/%llu=%.1E\n",
+                i, em.errors, em.bits, (double)em.errors / em.bits);
+
+        blk->commit_ts = now_us + (long long)(rx_delay - COMMIT_SLACK - chan_lead) * 1000;
+        if (rec_out.fp)
+            rec_put(&rec_out, REC_BLOCK, (int)(blk->commit_ts / 1000), blk->data, blk->wptr);
+        blk->link = NULL;
+
+        if (rblk_head == NULL)
+            rblk_head = rblk_tail = blk;
+        else {
+            rblk_tail->link = blk;
+            rblk_tail = blk;
+        }
+    }
+
+    if (more)
+        goto again;
+}
+
+/* Recording and Replay */
+
+static unsigned int replay_frames, replay_diffs;
+
+/* Record a frame sent, or on replay compare it with the one recorded */
+static void rec_frame(const unsigned char* frame, int len)
+{
+    static unsigned char expect[MAX_FRAME];
+    int ts, n;
+
+    if (!mode_replay) {
+        rec_put(&rec_out, REC_FRAME, now, frame, len);
+        return;
+    }
+
+    n = rec_get(&rec_tx, REC_FRAME, &ts, expect, sizeof(expect));
+    replay_frames++;
+    if (n != len || memcmp(expect, frame, len) != 0) {
+        if (replay_diffs++ == 0)
+            lprintf("Replay: frame %u differs from the recording, sent at %d ms, recorded at %d ms\n",
+                replay_frames, now, n < 0 ? -1 : ts);
+    }
+}
+
+/* Queue recorded blocks up to the first one still to come, so that next_deadline() sees it */
+static void replay_feed(void)
+{
+    struct BLK* blk;
+    int ts, n;
+
+    while (rec_in.fp && (rblk_head == NULL || rblk_tail->commit_ts <= now_us)) {
+        blk = (struct BLK*)pool_get(&blk_pool);
+        if ((n = rec_get(&rec_in, REC_BLOCK, &ts, blk->data, blk_size)) < 0) {
+            pool_put(&blk_pool, blk);
+            rec_close(&rec_in);
+            break;
+        }
+
+        blk->rptr = 0;
+        blk->wptr = n;
+        blk->commit_ts = (long long)ts * 1000;
+        blk->link = NULL;
+
+        if (rblk_head == NULL)
+            rblk_head = rblk_tail = blk;
+        else {
+            rblk_tail->link = blk;
+            rblk_tail = blk;
+        }
+    }
+}
+
+/* Channel Schedule */
+
+static STATION_LOCAL int sch_next; /* first change not applied yet */
+
+/* Apply the changes due by now: the pacer follows the direction sent on, delay and noise the one received on */
+static void sch_apply(void)
+{
+    int tx = station == 'a' ? SCH_AB : SCH_BA, rx = tx ^ (SCH_AB | SCH_BA);
+    struct SCH_ENTRY* e;
+    char buf[128];
+
+    for (; sch_next < sched.n && sched.e[sch_next].at <= now; sch_next++) {
+        e = &sched.e[sch_next];
+        if ((e->dirs & tx) && e->rate) {
+            send_credit(); /* the time so far is paid at the old rate */
+            tx_bps = e->rate;
+        }
+        if (e->dirs & rx) {
+            if (e->delay >= 0)
+                rx_delay = e->delay;
+            if (e->ber >= 0)
+                em_set_ber(&em, &rx_em, e->ber);
+        }
+        if (!io_thread || io_self) /* both threads follow the schedule, one tells */
+            lprintf("Schedule: %s\n", sch_describe(e, buf));
+    }
+}
+
+static int sch_deadline(void)
+{
+    return sch_next < sched.n ? sched.e[sch_next].at : INT_MAX;
+}
+
+/* Timer Management: binary min-heap ordered by deadline, then by arming order */
+
+struct TIMER {
+    long long deadline; /* us */
+    unsigned int seq; /* arming order, breaks ties between equal deadlines */
+    int id; /* timer No., ACK_TIMER_NR for the ACK timer */
+};
+
+/* Running timers by id, open addressing with linear probing: sized by how
+   many timers run, not by how large their numbers are */
+struct TSLOT {
+    int id;
+    int pos; /* heap index + 1, 0 for a free slot */
+};
+
+#define TSLOT_MIN 64
+#define TIMER_MAX (1 << 24) /* running at once */
+
+static STATION_LOCAL struct TIMER* theap;
+static STATION_LOCAL int theap_len, theap_size;
+static STATION_LOCAL struct TSLOT* tslot;
+static STATION_LOCAL unsigned int tslot_mask; /* slots - 1, a power of 2 less one */
+static STATION_LOCAL unsigned int timer_seq;
+
+#define timer_before(a, b) ((a)->deadline < (b)->deadline || ((a)->deadline == (b)->deadline && (a)->seq < (b)->seq))
+#define tslot_home(id) (((unsigned int)(id) * 2654435769u) & tslot_mask)
+
+/* the slot of timer 'id', or the free slot where it belongs */
+static struct TSLOT* tslot_find(int id)
+{
+    unsigned int i = tslot_home(id);
+
+    while (tslot[i].pos && tslot[i].id != id)
+        i = (i + 1) & tslot_mask;
+    return &tslot[i];
+}
+
+/* Free slot 'i', moving back the later slots of its probe run that would no longer be found */
+static void tslot_free(unsigned int i)
+{
+    unsigned int j = i, k;
+
+    for (;;) {
+        tslot[i].pos = 0;
+        do {
+            j = (j + 1) & tslot_mask;
+            if (!tslot[j].pos)
+                return;
+            k = tslot_home(tslot[j].id);
+        } while (i <= j ? i < k && k <= j : i < k || k <= j);
+        tslot[i] = tslot[j];
+        i = j;
+    }
+}
+
+/* Keep the table at most half full */
+static void tslot_grow(void)
+{
+    struct TSLOT* old = tslot;
+    size_t n = old ? (size_t)tslot_mask + 1 : 0, i;
+
+    if (old && (size_t)theap_len * 2 < n)
+        return;
+    if ((tslot = (struct TSLOT*)calloc(n ? n * 2 : TSLOT_MIN, sizeof(struct TSLOT))) == NULL)
+        ABORT("No enough memory");
+    tslot_mask = n ? (unsigned int)(n * 2 - 1) : TSLOT_MIN - 1;
+    for (i = 0; i < n; i++)
+        if (old[i].pos)
+            *tslot_find(old[i].id) = old[i];
+    free(old);
+}
+
+static void theap_set(int i, struct TIMER* t)
+{
+    struct TSLOT* s = tslot_find(t->id);
 
-    blk = (struct BLK*)malloc(sizeof(struct BLK));
-    if (blk == NULL)
-        ABORT("No enough memory");
+    theap[i] = *t;
+    s->id = t->id;
+    s->pos = i + 1;
+}
 
-    blk->rptr = 0;
-    blk->wptr = recv(sock, (char*)blk->data, BLKSIZE, 0);
-    if (blk->wptr <= 0) {
-        lprintf("TCP disconnected.\n");
-        exit(0);
-    }
-    nbits += blk->wptr * 4;
-
-    /* Impose noise */
-    if (ber != 0.0) {
-        int a;
-        double rate, fact;
-
-        rate = (double)noise / nbits;
-        fact = rate > ber ? 3.5 : 6.0;
-        a = (int)((1.0 - pow(1.0 - ber, fact * blk->wptr)) * (RAND_MAX + 1.0) + 0.5);
-        if (rand() <= a) {
-            p = &blk->data[rand() % blk->wptr];
-            if (*p & 0x0f) {
-                *p ^= 1 << (rand() % 8);
-                noise++;
-                dbg_warning("Impose noise on received data, %u/%u=%.1E\n", noise, nbits, (double)noise / nbits);
-            }
-        }
+static void theap_up(int i)
+{
+    struct TIMER t = theap[i];
+
+    while (i > 0 && timer_before(&t, &theap[(i - 1) / 2])) {
+        theap_set(i, &theap[(i - 1) / 2]);
+        i = (i - 1) / 2;
     }
+    theap_set(i, &t);
+}
 
-    blk->commit_ts = now + CHAN_DELAY - 10;
-    blk->link = NULL;
+static void theap_down(int i)
+{
+    struct TIMER t = theap[i];
+    int c;
 
-    if (rblk_head == NULL)
-        rblk_head = rblk_tail = blk;
-    else {
-        rblk_tail->link = blk;
-        rblk_tail = blk;
+    while ((c = 2 * i + 1) < theap_len) {
+        if (c + 1 < theap_len && timer_before(&theap[c + 1], &theap[c]))
+            c++;
+        if (!timer_before(&theap[c], &t))
+            break;
+        theap_set(i, &theap[c]);
+        i = c;
     }
+    theap_set(i, &t);
 }
 
-static unsigned char recv_byte(void)
+static void timer_remove(struct TSLOT* s)
 {
-    unsigned char ch;
-    struct BLK* blk = rblk_head;
+    int i = s->pos - 1;
 
-    if (blk == NULL || blk->commit_ts > now)
-        ABORT("recv_byte(): Receiving Queue is empty");
+    tslot_free((unsigned int)(s - tslot));
+    if (--theap_len == i)
+        return;
+    theap_set(i, &theap[theap_len]);
+    if (i > 0 && timer_before(&theap[i], &theap[(i - 1) / 2]))
+        theap_up(i);
+    else
+        theap_down(i);
+}
 
-    ch = blk->data[blk->rptr++];
-    if (blk->rptr == blk->wptr) {
-        rblk_head = blk->link;
-        free(blk);
+static void timer_arm(int id, long long deadline)
+{
+    struct TIMER t;
+    struct TSLOT* s;
+
+    tslot_grow();
+    if ((s = tslot_find(id))->pos)
+        timer_remove(s);
+
+    if (theap_len == theap_size) {
+        if (theap_size == TIMER_MAX)
+            ABORT("start_timer(): too many timers running");
+        theap_size = theap_size ? theap_size * 2 : TSLOT_MIN;
+        if ((theap = (struct TIMER*)realloc(theap, (size_t)theap_size * sizeof(struct TIMER))) == NULL)
+            ABORT("No enough memory");
     }
 
-    return ch;
+    t.deadline = deadline;
+    t.seq = timer_seq++;
+    t.id = id;
+    theap_set(theap_len, &t);
+    theap_up(theap_len++);
 }
 
-/* Timer Management */
+/* the slot of timer 'id' when it runs, NULL otherwise */
+static struct TSLOT* timer_running(int id)
+{
+    struct TSLOT* s;
+
+    return tslot && (s = tslot_find(id))->pos ? s : NULL;
+}
 
-#define NTIMER 129
-static int timer[NTIMER];
-#define ACK_TIMER_ID (NTIMER - 1)
+void start_timer_us(unsigned int nr, long long us)
+{
+    if (nr >= INT_MAX)
+        ABORT("start_timer(): bad timer No.");
+    timer_arm((int)nr, now_us + (long long)phl_sq_len() * 8000000 / tx_bps + us);
+}
 
 void start_timer(unsigned int nr, unsigned int ms)
 {
-    if (nr >= ACK_TIMER_ID)
-        ABORT("start_timer(): timer No. must be 0~128");
-    timer[nr] = now + phl_sq_len() * 8000 / CHAN_BPS + ms;
+    start_timer_us(nr, (long long)ms * 1000);
 }
 
 void stop_timer(unsigned int nr)
 {
-    if (nr < ACK_TIMER_ID)
-        timer[nr] = 0;
+    struct TSLOT* s;
+
+    if (nr < INT_MAX && (s = timer_running((int)nr)) != NULL)
+        timer_remove(s);
 }
 
 int get_timer(unsigned int nr)
 {
-    if (nr >= ACK_TIMER_ID || timer[nr] == 0)
+    struct TSLOT* s;
+    long long t;
+
+    if (nr >= INT_MAX || (s = timer_running((int)nr)) == NULL)
         return 0;
-    return timer[nr] > now ? timer[nr] - now : 0;
+    t = theap[s->pos - 1].deadline;
+    return t > now_us ? (int)((t - now_us + 999) / 1000) : 0;
+}
+
+void start_ack_timer_us(long long us)
+{
+    if (!timer_running(ACK_TIMER_NR))
+        timer_arm(ACK_TIMER_NR, now_us + us);
 }
 
 void start_ack_timer(unsigned int ms)
 {
-    if (timer[ACK_TIMER_ID] == 0)
-        timer[ACK_TIMER_ID] = now + ms;
+    start_ack_timer_us((long long)ms * 1000);
 }
 
 void stop_ack_timer(void)
 {
-    timer[ACK_TIMER_ID] = 0;
+    struct TSLOT* s;
+
+    if ((s = timer_running(ACK_TIMER_NR)) != NULL)
+        timer_remove(s);
 }
 
+/* Expire the earliest due timer; the ACK timer reports ACK_TIMER_NR as its No. */
 static int scan_timer(int* nr)
 {
-    int i;
+    int id;
 
-    for (i = 0; i < NTIMER; i++) {
-        if (timer[i] && timer[i] <= now) {
-            *nr = i;
-            timer[i] = 0;
-            return i == ACK_TIMER_ID ? ACK_TIMEOUT : DATA_TIMEOUT;
-        }
-    }
-    return 0;
+    if (theap_len == 0 || theap[0].deadline > now_us)
+        return 0;
+
+    id = theap[0].id;
+    timer_remove(tslot_find(id));
+    *nr = id;
+    return id == ACK_TIMER_NR ? ACK_TIMEOUT : DATA_TIMEOUT;
+}
+
+static long long timer_deadline(void)
+{
+    return theap_len ? theap[0].deadline : LLONG_MAX;
 }
 
 /* Network Layer Functions */
 
-static int network_layer_active = 0;
-static int rpackets, rbytes;
+static STATION_LOCAL int network_layer_active = 0;
+static STATION_LOCAL int rpackets, rbytes;
+static STATION_LOCAL int nl_last_ts, nl_idle_gap = 4000;
+
+/* open-loop models: packets arrived and not yet taken by the datalink */
+#define NL_QUEUE 1024 /* arrivals beyond this many waiting are dropped */
+#define tm_open() (tm_cfg.model >= TM_CBR)
+
+static STATION_LOCAL struct TM_STATE tm;
+static STATION_LOCAL int nl_backlog;
+static STATION_LOCAL unsigned long long nl_sent, nl_dropped;
+static STATION_LOCAL unsigned int nl_held, nl_nheld; /* held back by a full sending queue: now, times so far */
+
+/* traffic draws, (0, 1] */
+static double traffic_uniform(void)
+{
+    return rng_uniform(&rng_traffic);
+}
+
+/* Queue the arrivals due by now, at the rate the line has at the time */
+static void nl_arrivals(void)
+{
+    while (tm.next <= now) {
+        if (nl_backlog < NL_QUEUE)
+            nl_backlog++;
+        else
+            nl_dropped++;
+        tm_arrive(&tm, tx_bps, PKT_LEN * 8);
+    }
+}
 
 void enable_network_layer(void)
 {
@@ -599,90 +2182,141 @@ void disable_network_layer(void)
     network_layer_active = 0;
 }
 
-static int network_layer_ready(void)
+/* earliest time network_layer_ready() holds, INT_MAX while disabled */
+static int network_layer_deadline(void)
 {
-    static int last_ts = 0;
+    int t, boundary;
 
-    if (!network_layer_active)
-        return 0;
+    if (!network_layer_active || nl_held)
+        return INT_MAX;
 
-    if (mode_flood)
-        return 1;
+    if (tm_cfg.model == TM_FLOOD)
+        return now;
 
-    if ((now - last_ts) * CHAN_BPS / 8 / 1000 < PKT_LEN * 3 / 4)
-        return 0;
+    if (tm_open()) {
+        if (nl_backlog)
+            return now;
+        return tm.next < INT_MAX ? (int)ceil(tm.next) : INT_MAX;
+    }
+
+    /* about 3/4 of line rate */
+    t = nl_last_ts + (PKT_LEN * 3 / 4 * 8000 + tx_bps - 1) / tx_bps;
 
     if (station == 'b') {
-        if (now / 1000 / mode_cycle % 2 != mode_ibib) {
-            if (now - last_ts < 4000 + rand() % 500)
-                return 0;
+        if (t < chan_delay + 3 * PKT_LEN * 8000 / chan_bps)
+            t = chan_delay + 3 * PKT_LEN * 8000 / chan_bps;
+        if (t / 1000 / mode_cycle % 2 != mode_ibib && t < nl_last_ts + nl_idle_gap) {
+            /* IDLE period: hold until the gap elapses or the BUSY period begins */
+            boundary = (t / 1000 / mode_cycle + 1) * mode_cycle * 1000;
+            t = boundary < nl_last_ts + nl_idle_gap ? boundary : nl_last_ts + nl_idle_gap;
         }
-        if (now < CHAN_DELAY + 3 * PKT_LEN * 8000 / CHAN_BPS)
-            return 0;
     }
 
-    last_ts = now;
+    return t;
+}
+
+static int network_layer_ready(void)
+{
+    if (tm_open())
+        nl_arrivals();
+
+    /* back-pressure: no new packet until the sending queue is below its high watermark */
+    if (phl_sq_len() >= sq_high) {
+        nl_nheld += !nl_held;
+        nl_held = 1;
+        return 0;
+    }
+    nl_held = 0;
+
+    if (now < network_layer_deadline())
+        return 0;
+
+    nl_last_ts = now;
+    nl_sent++;
+    if (tm_open())
+        nl_backlog--;
+    else if (station == 'b' && tm_cfg.model == TM_LEGACY)
+        nl_idle_gap = 4000 + rng_below(&rng_traffic, 500);
 
     return 1;
 }
 
-static int randA(void)
+/* Offered load against what the datalink took */
+static void nl_report(void)
 {
-    static unsigned int holdrand = 0x65109bc4;
-    return ((holdrand = holdrand * 214013L + 2531011L) >> 16) & 0x7fff;
+    double secs = now > 0 ? now / 1000.0 : 1.0;
+
+    if (nl_nheld)
+        lprintf("Traffic: held back %u times by a full sending queue\n", nl_nheld);
+    if (!tm_open()) {
+        lprintf("Traffic: %llu packets sent, %.0f bps\n", nl_sent, nl_sent * PKT_LEN * 8 / secs);
+        return;
+    }
+    lprintf("Traffic: %llu packets offered, %.0f bps, %.1f%% of line rate\n",
+        tm.offered, tm.offered_bits / secs, tm.offered_bits / secs / chan_bps * 100);
+    lprintf("Traffic: %llu sent (%.1f%% of offered), %llu dropped, %d waiting\n",
+        nl_sent, tm.offered ? nl_sent * 100.0 / tm.offered : 0.0, nl_dropped, nl_backlog);
 }
 
-static int randB(void)
+/* Per-station network layer: its traffic source, paced against the line rate */
+static void nl_init(void)
 {
-    static unsigned int holdrand = 0x1e459090;
-    return ((holdrand = holdrand * 214013L + 2531011L) >> 16) & 0x7fff;
+    rng_seed(&rng_traffic, mode_seed, rng_stream(RNG_TRAFFIC, station));
+    tx_bps = chan_bps;
+    tm_init(&tm, &tm_cfg, traffic_uniform, 0);
 }
 
-#define next_char() ((unsigned char)(my_rand() & 0xff))
+static STATION_LOCAL int layer3_ready = 0;
 
-static int layer3_ready = 0;
+/* payload key of the 'n'th packet station 'st' sends: a running count, as ids wrap around every 10000 */
+#define pkt_key(st, n) pl_key(mode_seed, (unsigned int)(n) * 2 + (unsigned int)((st) - 'a'))
 
 int get_packet(unsigned char* packet)
 {
-    static int pkt_no = 0;
-    int i, len;
-    int (*my_rand)(void) = station == 'a' ? randA : randB;
+    static STATION_LOCAL unsigned int pkt_no = 0;
+    int len;
 
     if (!layer3_ready)
         ABORT("get_packet(): Network layer is not ready for a new packet");
 
     len = PKT_LEN;
-    for (i = 2; i < len; i++)
-        packet[i] = next_char();
-    *(unsigned short*)packet = (station - 'a' + 1) * 10000 + (pkt_no++ % 10000);
+    *(unsigned short*)packet = (unsigned short)((station - 'a' + 1) * 10000 + pkt_no % 10000);
+    pl_fill(pkt_key(station, pkt_no), packet + 2, len - 2);
+    pkt_no++;
 
     layer3_ready = 0;
 
     return len;
 }
 
-static int ts0;
+static STATION_LOCAL int ts0;
 
 void put_packet(unsigned char* packet, int len)
 {
-    static int last_ts = 0;
-    int i, (*my_rand)(void) = station == 'a' ? randB : randA;
+    static STATION_LOCAL int last_ts = 0;
+    unsigned short id = *(unsigned short*)packet;
 
     if (len != PKT_LEN)
         ABORT("Bad Packet length");
 
-    for (i = 2; i < PKT_LEN; i++) {
-        if (packet[i] != next_char())
-            ABORT("Network Layer received a bad packet from data link layer");
-    }
+    /* the payload follows from how many packets came before, so a stale one with the same id fails too */
+    if (!pl_check(pkt_key(station == 'a' ? 'b' : 'a', rpackets), packet + 2, PKT_LEN - 2))
+        ABORT("Network Layer received a bad packet from data link layer");
+    if (id != (station == 'a' ? 2 : 1) * 10000 + rpackets % 10000)
+        ABORT("Network Layer received a packet out of order from data link layer");
     rpackets++;
     rbytes += len;
 
     if (now - last_ts > 2000 && now > ts0 + 2000) {
+        const struct EM_STATE* e = &em;
         double bps;
+#ifndef _WIN32
+        if (io_thread)
+            e = io_em; /* counters of another thread, only for show */
+#endif
         bps = (double)rbytes * 8 * 1000 / (now - ts0);
         lprintf(".... %d packets received, %.0f bps, %.2f%%, Err %d (%.1e)\n",
-            rpackets, bps, bps / CHAN_BPS * 100, noise, (double)noise / nbits);
+            rpackets, bps, bps / chan_bps * 100, (int)e->errors, e->bits ? (double)e->errors / e->bits : 0.0);
         last_ts = now;
     }
 }
@@ -726,117 +2360,662 @@ void dbg_warning(char* fmt, ...)
 
 /* Event Generator */
 
-#define PHL_SQ_LEVEL 50
+static STATION_LOCAL int phl_events; /* socket readiness reported by the last phl_wait() */
+
+/*
+ * Received frames: reassembly decodes straight into a slot of a fixed
+ * array, and a completed frame is published by advancing the tail of a
+ * ring of slot numbers kept in due order. recv_frame() pops the head;
+ * slots come and go through a stack of free ones, nothing is allocated
+ * once the array is sized.
+ */
+struct RCV_SLOT {
+    long long due; /* us the frame is handed to the datalink */
+    struct LC_STATE lc;
+    unsigned char frame[MAX_FRAME];
+};
 
-static int sleep_cnt, start_ms, wakeup_ms, busy_cnt;
-static int bias_cnt;
+static STATION_LOCAL struct RCV_SLOT* rs_slot;
+static STATION_LOCAL int *rs_ring, *rs_free; /* published slots from rs_head to rs_tail, free slots */
+static STATION_LOCAL unsigned int rs_head, rs_tail, rs_mask;
+static STATION_LOCAL int rs_nslot, rs_nfree, rs_hiwater, rs_ngrow;
+static STATION_LOCAL int rs_cur = -1; /* slot being reassembled */
 
-struct RCV_FRAME {
-    int len;
-    int state;
-    unsigned char frame[2048];
-    struct RCV_FRAME* link;
-};
+#define rs_first() (&rs_slot[rs_ring[rs_head & rs_mask]])
+
+/* Add 'n' slots; the ring keeps its order at the same head and tail, as wide as the slots are many */
+static void rs_grow(int n)
+{
+    int i, nslot = rs_nslot + n;
+    unsigned int p, mask;
+    int* ring;
+
+    for (mask = 1; mask < (unsigned int)nslot; mask <<= 1)
+        ;
+    mask--;
+    rs_slot = (struct RCV_SLOT*)realloc(rs_slot, nslot * sizeof(struct RCV_SLOT));
+    rs_free = (int*)realloc(rs_free, nslot * sizeof(int));
+    if ((ring = (int*)malloc((mask + 1) * sizeof(int))) == NULL || rs_slot == NULL || rs_free == NULL)
+        ABORT("No enough memory for received frames");
+
+    for (p = rs_head; p != rs_tail; p++)
+        ring[p & mask] = rs_ring[p & rs_mask];
+    free(rs_ring);
+    rs_ring = ring;
+    rs_mask = mask;
+
+    for (i = nslot - 1; i >= rs_nslot; i--)
+        rs_free[rs_nfree++] = i;
+    if (rs_nslot)
+        rs_ngrow++;
+    rs_nslot = nslot;
+}
+
+/* Per-station physical layer: sending queue, error state and pools sized for what a channel delay holds */
+static void phl_init(void)
+{
+    int line_bytes = (int)((long long)chan_delay * (chan_bps / line_bits) / 1000); /* line bytes in flight */
+    int shortest = lc_bound(linecode, 2 + 4); /* ACK/NAK frame */
+    int nframe = line_bytes / shortest + 8;
+
+    /* room for twice the high watermark to start with */
+    for (sq_cap = 8192; sq_cap < 2 * sq_high && sq_cap < sq_size; sq_cap *= 2)
+        ;
+    if (sq_cap > sq_size)
+        sq_cap = sq_size;
+    if ((sq = (unsigned char*)malloc(sq_cap)) == NULL)
+        ABORT("No enough memory for the sending queue");
+
+#ifndef _WIN32
+    if (mode_uring) {
+        const char* why = ur_init(sock, blk_size);
+
+        if (why)
+            lprintf("io_uring: %s, plain TCP instead\n", why);
+        else {
+            phl = &uring_ops;
+            if (ur_register(sq, sq_cap) < 0)
+                lprintf("io_uring: the sending queue could not be registered, plain sends\n");
+        }
+    }
+#endif
+
+    rng_seed(&rng_noise, mode_seed, rng_stream(RNG_NOISE, station));
+    rng_seed(&rng_netem, mode_seed, rng_stream(RNG_NETEM, station));
+
+    if (rec_name) {
+        char fname[1024];
+        struct REC_INFO info;
+        const char* ext = strrchr(rec_name, '.');
+        int n = ext && !strpbrk(ext, "/\\") ? (int)(ext - rec_name) : (int)strlen(rec_name);
+
+        /* in-process and launched runs record each station in a file of its own, "run.rec" to "run-A.rec" */
+        if (mode_local || mode_launch)
+            sprintf(fname, "%.*s-%s%s", n, rec_name, station_name(), rec_name + n);
+        else
+            sprintf(fname, "%.1000s", rec_name);
+
+        info.station = station;
+        info.linecode = linecode;
+        info.bps = chan_bps;
+        info.delay = chan_delay;
+        info.tick = mode_tick;
+        info.life = mode_life;
+        info.seed = mode_seed;
+        info.flood = mode_flood;
+        info.ibib = mode_ibib;
+        info.queue = sq_size;
+        strcpy(info.netem, ne_spec);
+        strcpy(info.schedule, sch_name);
+        strcpy(info.traffic, tm_spec);
+        if (rec_create(&rec_out, fname, &info) < 0)
+            ABORT("Failed to create the recording");
+    }
+
+    tx_bps = chan_bps;
+    rx_delay = chan_delay;
+    rx_em = em_cfg;
+    em_init(&em, &rx_em, noise_uniform);
+    ne_init(&ne, &ne_cfg, netem_uniform);
+
+    /* fast lines: the datalink drains frames long before that many are due at once */
+    if (nframe > 1024)
+        nframe = 1024;
+
+    pool_init(&blk_pool, "BLK", sizeof(struct BLK) + blk_size,
+        chan_delay / SEND_SLOT_MS + line_bytes / blk_size + 2 * RECV_IOV);
+    rs_grow(nframe);
+}
+
+/* Take a slot, its decoder state cleared */
+static int rs_alloc(void)
+{
+    int id;
+
+    if (rs_nfree == 0)
+        rs_grow(rs_nslot);
+    id = rs_free[--rs_nfree];
+    memset(&rs_slot[id].lc, 0, sizeof(rs_slot[id].lc));
+    if (rs_nslot - rs_nfree > rs_hiwater)
+        rs_hiwater = rs_nslot - rs_nfree;
+    return id;
+}
+
+/* Publish slot 'id' by due time; without reordering it also waits for the one before */
+static void rs_publish(int id, long long due)
+{
+    unsigned int p = rs_tail;
+
+    if (!ne_cfg.reorder && rs_head != rs_tail && due < rs_slot[rs_ring[(p - 1) & rs_mask]].due)
+        due = rs_slot[rs_ring[(p - 1) & rs_mask]].due;
+    rs_slot[id].due = due;
+
+    /* only a jittered frame overtaking others moves any */
+    for (; p != rs_head && rs_slot[rs_ring[(p - 1) & rs_mask]].due > due; p--)
+        rs_ring[p & rs_mask] = rs_ring[(p - 1) & rs_mask];
+    if (p != rs_tail)
+        ne.reordered++;
+    rs_ring[p & rs_mask] = id;
+    rs_tail++;
+}
+
+/* A delimited frame, its bytes committed at 'ts': drop, duplicate or delay it */
+static void rs_deliver(int id, long long ts)
+{
+    int dup;
+
+    if (!ne_cfg.active) {
+        rs_publish(id, ts);
+        return;
+    }
+
+    if (ne_lose(&ne)) {
+        rs_free[rs_nfree++] = id;
+        return;
+    }
+
+    if (ne_duplicate(&ne)) {
+        dup = rs_alloc();
+        rs_slot[dup].lc = rs_slot[id].lc;
+        memcpy(rs_slot[dup].frame, rs_slot[id].frame, rs_slot[id].lc.len);
+        rs_publish(dup, ts + (long long)(chan_lead + ne_jitter(&ne)) * 1000);
+    }
+
+    rs_publish(id, ts + (long long)(chan_lead + ne_jitter(&ne)) * 1000);
+}
+
+static void rs_pop(void)
+{
+    rs_free[rs_nfree++] = rs_ring[rs_head++ & rs_mask];
+}
 
-static struct RCV_FRAME *rf_head, *rf_tail, *rf_buf;
+/* the first frame is due */
+static int rs_ready(void)
+{
+    return rs_head != rs_tail && rs_first()->due <= now_us;
+}
 
 int recv_frame(unsigned char* buf, int size)
 {
     int len;
-    struct RCV_FRAME* next;
     char msg[256];
 
-    if (rf_head == NULL)
+#ifndef _WIN32
+    if (io_thread) {
+        if ((len = spsc_peek(&io_rx)) == 0)
+            ABORT("recv_frame(): Receiving Queue is empty");
+        if (size < len) {
+            sprintf(msg, "recv_frame(): %d-byte buffer is too small to save %d-byte received frame", size, len);
+            ABORT(msg);
+        }
+        if (ts0 == 0)
+            ts0 = now;
+        return spsc_pop(&io_rx, buf, size);
+    }
+#endif
+
+    if (rs_head == rs_tail)
         ABORT("recv_frame(): Receiving Queue is empty");
 
-    len = rf_head->len;
+    len = rs_first()->lc.len;
 
     if (size < len) {
         sprintf(msg, "recv_frame(): %d-byte buffer is too small to save %d-byte received frame", size, len);
         ABORT(msg);
     }
 
-    memcpy(buf, rf_head->frame, len);
-
-    next = rf_head->link;
-    if (next == NULL)
-        rf_tail = NULL;
-    free(rf_head);
-    rf_head = next;
+    memcpy(buf, rs_first()->frame, len);
+    rs_pop();
 
     return len;
 }
 
-int wait_for_event(int* arg)
+/* Block until the line is ready or the 'deadline' (us) is reached */
+static int phl_wait(long long deadline)
 {
-    fd_set rfd, wfd;
-    struct timeval tm;
-    int event, n, i;
-    unsigned char ch;
+    int want, ready;
 
-    for (;;) {
+    /* while a rate slot is pending, received data is drained at the slot */
+    want = (send_deadline() == LLONG_MAX ? PHL_READABLE : 0) | (sq_stalled ? PHL_WRITABLE : 0);
 
-        now = get_ms();
+    nsys_wait++;
+    ready = phl->wait(deadline, want);
 
-        /* commit received socket data */
-        if (rblk_head && rblk_head->commit_ts <= now) {
-            n = rblk_head->wptr - rblk_head->rptr;
+    if (!(want & PHL_READABLE) && deadline >= send_deadline())
+        ready |= PHL_READABLE;
+    return ready;
+}
 
-            if (ts0 == 0) {
-                ts0 = now;
-                if (ts0 >= n / 2)
-                    ts0 -= n / 2;
-            }
+/* A sleep until 'deadline' (us) has returned: sample how late, if it was */
+static void wake_sample(long long deadline)
+{
+    long long late;
+    int b;
 
-            for (i = 0; i < n; i++) {
-                ch = recv_byte();
-                if (ch == 0xff) {
-                    if (rf_buf == NULL)
-                        rf_buf = (struct RCV_FRAME*)calloc(1, sizeof(struct RCV_FRAME));
-                    else {
-                        if (rf_buf->len > 0) {
-                            if (rf_head == NULL)
-                                rf_head = rf_tail = rf_buf;
-                            else {
-                                rf_tail->link = rf_buf;
-                                rf_tail = rf_buf;
-                            }
-                            rf_buf = NULL;
-                        }
-                    }
-                } else if (rf_buf && rf_buf->len < sizeof(rf_buf->frame)) {
-                    if (rf_buf->state == 0) {
-                        rf_buf->frame[rf_buf->len] = ch;
-                        rf_buf->state = 1;
-                    } else {
-                        rf_buf->frame[rf_buf->len] |= (ch << 4) ^ (ch & 0xf0);
-                        rf_buf->len++;
-                        rf_buf->state = 0;
-                    }
-                }
+    if (deadline == LLONG_MAX || mode_local || mode_replay || (late = get_us() - deadline) < 0)
+        return;
+    for (b = 0; b < WAKE_HIST - 1 && late >> b; b++)
+        ;
+    wake_hist[b]++;
+    wake_n++;
+    wake_sum += late;
+    if (late > wake_max)
+        wake_max = late;
+}
+
+/* phl_wait(), busy-polling the line the last --realtime spin us before the deadline */
+static int phl_sleep(long long deadline)
+{
+    int ready;
+
+#ifndef _WIN32
+    if (rt_cfg.spin && deadline != LLONG_MAX) {
+        ready = phl_wait(deadline - rt_cfg.spin);
+        /* the I/O thread also stops for a frame from the protocol thread */
+        while (ready == 0 && get_us() < deadline && !(io_self && spsc_peek(&io_tx)))
+            ready = phl_wait(0);
+        /* at the deadline itself, as if it had slept until then */
+        if (ready == 0 && get_us() >= deadline)
+            ready = phl_wait(deadline);
+    } else
+#endif
+        ready = phl_wait(deadline);
+
+    wake_sample(deadline);
+    return ready;
+}
+
+/* Sending queue size and the share of time spent at each depth */
+static void sq_report(void)
+{
+    char hist[SQ_HIST * 24], *p = hist;
+    long long total = 0;
+    unsigned int drops = sq_drops;
+    int i;
+
+#ifndef _WIN32
+    drops += __atomic_load_n(&io_drops, __ATOMIC_RELAXED);
+#endif
+    sq_sample();
+    for (i = 0; i < SQ_HIST; i++)
+        total += sq_hist[i];
+    lprintf("Sending queue: %d bytes, grown %u times, %u frames dropped, %.1f%% of the time from the high watermark\n",
+        sq_cap, sq_ngrow, drops, total ? sq_high_us * 100.0 / total : 0.0);
+    if (total == 0)
+        return;
+    for (i = 0; i < SQ_HIST; i++) {
+        if (sq_hist[i])
+            p += sprintf(p, " %s%d:%.1f%%", i ? "<" : "", i ? 1 << (i < 31 ? i : 30) : 0, sq_hist[i] * 100.0 / total);
+    }
+    lprintf("Sending queue depth, share of time:%s\n", hist);
+}
+
+/* Wakeup latency of the calling thread, 'who' */
+static void wake_report(const char* who)
+{
+    char hist[WAKE_HIST * 24], *p = hist;
+    int i;
+
+    if (wake_n == 0)
+        return;
+    lprintf("Wakeups of the %s: %llu at a deadline, %.0f us late on average, %lld us at most\n",
+        who, wake_n, (double)wake_sum / wake_n, wake_max);
+    for (i = 0; i < WAKE_HIST; i++) {
+        if (wake_hist[i])
+            p += sprintf(p, " %s%d:%.1f%%", i ? "<" : "", i ? 1 << i : 0, wake_hist[i] * 100.0 / wake_n);
+    }
+    lprintf("Wakeup latency (us), share of wakeups:%s\n", hist);
+}
+
+/* 'packets': received by the datalink, which may be another thread */
+static void phl_report(int packets)
+{
+    unsigned int nsys = nsys_send + nsys_recv + nsys_wait;
+#ifndef _WIN32
+    double mb = (nline_sent + nline_recv) / 1048576.0;
+    struct rusage ru;
+    char buf[128];
+
+    if (phl == &uring_ops)
+        nsys = ur_enters(); /* taking input is no system call there */
+#endif
+
+    lprintf("Physical layer: %u send, %u recv, %u wait calls, %.2f syscalls per packet\n",
+        nsys_send, nsys_recv, nsys_wait, packets ? (double)nsys / packets : 0.0);
+#ifndef _WIN32
+    if (mb > 0.0 && getrusage(RUSAGE_THREAD, &ru) == 0)
+        lprintf("Physical layer: %.2f MB on the line, %.0f syscalls and %.0f context switches per MB (%s)\n",
+            mb, nsys / mb, (ru.ru_nvcsw + ru.ru_nivcsw) / mb, phl->name);
+    if (io_thread) {
+        lprintf("I/O thread: tx ring %s\n", spsc_describe(&io_tx, buf));
+        lprintf("I/O thread: rx ring %s\n", spsc_describe(&io_rx, buf));
+        lprintf("I/O thread: %u kicks from the protocol thread, %llu wakeups of it\n", io_kicks, io_bell.wakes);
+    }
+#endif
+    sq_report();
+    wake_report(io_self ? "I/O thread" : "station");
+    if (em.bits)
+        lprintf("Bit errors: %llu in %llu bits, BER %.2E achieved, %.2E configured\n",
+            em.errors, em.bits, (double)em.errors / em.bits, em_expected(&rx_em, line_bits));
+    if (ne_cfg.active)
+        lprintf("Impairments: %llu frames, %llu lost, %llu duplicated, %llu reordered\n",
+            ne.frames, ne.lost, ne.dups, ne.reordered);
+    if (rec_out.fp)
+        lprintf("Record: %llu bytes received and sent\n", rec_out.bytes);
+    if (mode_replay)
+        lprintf("Replay: %u frames sent, %u differ from the recording\n", replay_frames, replay_diffs);
+    pool_report(&blk_pool);
+    lprintf("Receive slots: high water %d of %d, grown %d times\n", rs_hiwater, rs_nslot, rs_ngrow);
+}
+
+/* earliest instant (us) at which the physical layer has something to do */
+static long long phl_deadline(void)
+{
+    long long t = LLONG_MAX, t1, slot = send_deadline();
+
+    if (rblk_head) {
+        t1 = rblk_head->commit_ts;
+        if (slot > t1 && slot - t1 <= COMMIT_SLACK * 1000)
+            t1 = slot;
+        if (t1 < t)
+            t = t1;
+    }
+    if (slot < t)
+        t = slot;
+    /* a frame already due waits for room in the ring to the protocol thread: look again shortly */
+    if (rs_head != rs_tail && rs_first()->due < t)
+        t = rs_first()->due > now_us ? rs_first()->due : now_us + 1000;
+    if ((t1 = deadline_us(sch_deadline())) < t)
+        t = t1;
+    return t;
+}
+
+/* earliest instant (us) at which wait_for_event() has something to do */
+static long long next_deadline(void)
+{
+    long long t = deadline_us(mode_life + 1), t1;
+
+    if (!io_thread && (t1 = phl_deadline()) < t)
+        t = t1;
+    if ((t1 = timer_deadline()) < t)
+        t = t1;
+    if ((t1 = deadline_us(network_layer_deadline())) < t)
+        t = t1;
+    if ((t1 = deadline_us(sch_deadline())) < t)
+        t = t1;
+    return t;
+}
+
+/* Split line bytes committed at 'ts' (us) at delimiters and decode them into frames */
+static void reassemble(const unsigned char* line, int n, long long ts)
+{
+    int seg;
+
+    while (n > 0) {
+        seg = lc_find(linecode, line, n);
+
+        if (seg > 0) {
+            /* a COBS frame begins right after any delimiter */
+            if (rs_cur < 0 && linecode == LINECODE_COBS)
+                rs_cur = rs_alloc();
+            if (rs_cur >= 0)
+                lc_decode(linecode, &rs_slot[rs_cur].lc, line, seg, rs_slot[rs_cur].frame, MAX_FRAME);
+        }
+
+        if (seg < n) {
+            if (rs_cur < 0) {
+                if (linecode == LINECODE_NIBBLE)
+                    rs_cur = rs_alloc();
+            } else if (rs_slot[rs_cur].lc.len > 0) {
+                rs_deliver(rs_cur, ts);
+                rs_cur = -1;
             }
+            seg++;
+        }
 
-            if (rf_head)
-                return FRAME_RECEIVED;
+        line += seg;
+        n -= seg;
+    }
+}
+
+/* Commit received socket data */
+static void rblk_commit(void)
+{
+    struct BLK* blk;
+    int n;
+
+    while (rblk_head && rblk_head->commit_ts <= now_us) {
+        blk = rblk_head;
+        n = blk->wptr - blk->rptr;
+
+        if (ts0 == 0) {
+            ts0 = now;
+            if (ts0 >= n * line_bits * 1000 / chan_bps)
+                ts0 -= n * line_bits * 1000 / chan_bps;
         }
 
-        /* test socket send/receive */
-        tm.tv_sec = tm.tv_usec = 0;
-        FD_ZERO(&rfd);
-        FD_ZERO(&wfd);
-        FD_SET(sock, &rfd);
-        FD_SET(sock, &wfd);
+        reassemble(blk->data + blk->rptr, n, blk->commit_ts);
+
+        rblk_head = blk->link;
+        pool_put(&blk_pool, blk);
+    }
+}
+
+/* Line I/O of a wait_for_event() round: flush the pacer, drain the socket */
+static void phl_poll(void)
+{
+    if (peer_gone())
+        return;
+
+    /* socket send, unless the last flush is still waiting for room */
+    if (!sq_stalled || (phl_events & PHL_WRITABLE))
+        socket_send();
+
+    /* socket receive */
+    if (phl_events & PHL_READABLE)
+        socket_recv();
+
+    phl_events = 0;
+}
+
+#ifndef _WIN32
 
-        if (select(sock + 1, &rfd, &wfd, 0, &tm) < 0)
-            ABORT("system select()");
+/* I/O Thread */
 
-        /* socket send */
-        if (FD_ISSET(sock, &wfd))
-            socket_send();
+/* Wake the I/O thread if it sleeps in phl_wait() */
+static void io_kick(void)
+{
+    static const unsigned long long one = 1;
+
+    if (!__atomic_load_n(&io_asleep, __ATOMIC_SEQ_CST))
+        return;
+    io_kicks++;
+    if (phl == &shm_ops)
+        shr_kick();
+    else if (write(io_efd, &one, sizeof(one)) < 0)
+        ABORT("system write()");
+}
+
+/* the next frame in the tx ring fits into the sending queue */
+static int io_tx_ready(void)
+{
+    int len = spsc_peek(&io_tx);
+
+    return len > 0 && sq_room(lc_bound(linecode, len));
+}
+
+static void* io_main(void* arg)
+{
+    static unsigned char frame[MAX_FRAME];
+    unsigned int len, seq;
+    int ring;
+    char buf[128];
+    const char* refused;
+
+    station = (int)(long)arg;
+    sock = io_sock;
+    io_self = 1;
+    if (rt_cfg.active && (refused = rt_apply(&rt_cfg, 1, buf)) != NULL)
+        lprintf("Real-time: I/O thread refused %s, running without\n", refused);
+    phl_init();
+    io_em = &em;
+
+    for (;;) {
+        now_us = get_us();
+        now = (int)(now_us / 1000);
+        sch_apply();
+
+        while (io_tx_ready())
+            phl_send(frame, spsc_pop(&io_tx, frame, sizeof(frame)));
+
+        rblk_commit();
+
+        /* hand the frames due over, as many as the ring takes */
+        for (ring = 0; rs_ready() && spsc_push(&io_rx, rs_first()->frame, rs_first()->lc.len); ring = 1)
+            rs_pop();
+
+        phl_poll();
+
+        /* the protocol thread may wait for the queue to drain */
+        len = (unsigned int)sq_len();
+        if (len != io_sq) {
+            __atomic_store_n(&io_sq, len, __ATOMIC_RELEASE);
+            if ((int)len < sq_low)
+                ring = 1;
+        }
+        if (ring)
+            spsc_bell_ring(&io_bell);
+
+        if (peer_gone()) {
+            /* the protocol thread quits on the bell and stops this one */
+            spsc_bell_ring(&io_bell);
+            for (seq = spsc_bell_seq(&io_quit_bell); !__atomic_load_n(&io_quit, __ATOMIC_ACQUIRE); seq = spsc_bell_seq(&io_quit_bell))
+                spsc_bell_wait(&io_quit_bell, seq, NULL);
+            break;
+        }
+
+        if (__atomic_load_n(&io_quit, __ATOMIC_ACQUIRE))
+            break;
+
+        /* announced before the last look at the ring, so a frame sent after it kicks */
+        __atomic_store_n(&io_asleep, 1, __ATOMIC_SEQ_CST);
+        if (!io_tx_ready() && !__atomic_load_n(&io_quit, __ATOMIC_SEQ_CST))
+            phl_events = phl_sleep(phl_deadline());
+        __atomic_store_n(&io_asleep, 0, __ATOMIC_SEQ_CST);
+    }
+
+    phl_report(io_rpackets);
+    return arg;
+}
+
+/* The line is connected: hand it to a thread of its own */
+static void io_start(void)
+{
+    if (spsc_init(&io_tx, sq_size) < 0 || spsc_init(&io_rx, 64 * 1024) < 0)
+        ABORT("No enough memory for the I/O rings");
+    if (phl == &tcp_ops && (io_efd = eventfd(0, EFD_NONBLOCK)) < 0)
+        ABORT("system eventfd()");
+
+    io_sock = sock;
+    if (pthread_create(&io_tid, NULL, io_main, (void*)(long)station) != 0)
+        ABORT("Create the I/O thread");
+}
+
+/* Let the I/O thread report and wait until it has */
+static void io_stop(void)
+{
+    io_rpackets = rpackets;
+    __atomic_store_n(&io_quit, 1, __ATOMIC_SEQ_CST);
+    spsc_bell_ring(&io_quit_bell);
+    io_kick();
+    pthread_join(io_tid, NULL);
+}
 
-        /* socket receive */
-        if (FD_ISSET(sock, &rfd))
-            socket_recv();
+#endif
+
+/* End of the run: report and exit */
+static void station_quit(void)
+{
+    nl_report();
+#ifndef _WIN32
+    if (io_thread) {
+        wake_report("protocol thread");
+        io_stop();
+    } else
+#endif
+        phl_report(rpackets);
+#ifndef _WIN32
+    if (mode_switch && session == 0 && station == 'a')
+        sw_report();
+#endif
+    lprintf("Quit.\n");
+#ifndef _WIN32
+    if (mode_local)
+        sc_exit();
+#endif
+    exit(0);
+}
+
+int wait_for_event(int* arg)
+{
+    int event;
+#ifndef _WIN32
+    unsigned int seq = 0;
+    struct timespec ts;
+    long long deadline;
+#endif
+
+    for (;;) {
+
+#ifndef _WIN32
+        if (io_thread)
+            seq = spsc_bell_seq(&io_bell);
+#endif
+        now_us = get_us();
+        now = (int)(now_us / 1000);
+        sch_apply();
+
+#ifndef _WIN32
+        if (io_thread) {
+            if (spsc_peek(&io_rx))
+                return FRAME_RECEIVED;
+        } else
+#endif
+        {
+            if (mode_replay)
+                replay_feed();
+
+            rblk_commit();
+
+            if (rs_ready())
+                return FRAME_RECEIVED;
+
+            phl_poll();
+        }
+
+        /* the peer quit at the end of the run, nothing more comes */
+        if (peer_gone())
+            station_quit();
 
         /* network layer event */
         if (network_layer_ready()) {
@@ -849,52 +3028,28 @@ int wait_for_event(int* arg)
             return event;
 
         /* physical layer event */
-        if (inform_phl_ready && phl_sq_len() < PHL_SQ_LEVEL) {
+        if (inform_phl_ready && phl_sq_len() < sq_low) {
             inform_phl_ready = 0;
             return PHYSICAL_LAYER_READY;
         }
 
-        /* delay 'mode_tick' ms */
-        if (1) {
-            int ms0, t;
-            static time_t last_warn;
-            ms0 = get_ms();
-            magic_check();
-            Sleep(mode_tick);
-            t = get_ms() - ms0;
-            if (t > mode_tick + 50 && time(0) > last_warn + 1) {
-                lprintf("** WARNING: System too busy, sleep %d ms, but be awakened %d ms later\n",
-                    mode_tick, t);
-                last_warn = time(0);
-            }
-        } else {
-            int ticks, ms;
-
-            sleep_cnt++;
-
-            ms = get_ms();
-            if (start_ms == 0)
-                start_ms = ms;
-            else if (ms - wakeup_ms > 1) {
-                ticks = (ms - start_ms) / mode_tick;
-                lprintf("====== CPU BUSY for %d ms (cnt %d)\n", ms - wakeup_ms, ++busy_cnt);
-                lprintf("------ noSleep %d, sleep %d, Elapse %d ticks\n", ticks - sleep_cnt, sleep_cnt, ticks);
-            }
-
-            magic_check();
-            ms = get_ms();
-            Sleep(mode_tick);
-            wakeup_ms = get_ms();
-
-            ms = wakeup_ms - ms;
-            if (ms > mode_tick + 1 || ms < mode_tick - 1)
-                lprintf("++++++ Sleep(%d)=%d+%d (cnt %d)\n", mode_tick, mode_tick, ms - mode_tick, ++bias_cnt);
-        }
-
-        if (now > mode_life) {
-            lprintf("Quit.\n");
-            exit(0);
+        if (now > mode_life)
+            station_quit();
+
+        /* sleep until the socket is ready or the next deadline */
+        magic_check();
+#ifndef _WIN32
+        if (io_thread) {
+            /* or until the I/O thread rings: a frame, or room in the sending queue */
+            deadline = next_deadline();
+            spsc_bell_wait(&io_bell, seq, phl_timeout(rt_cfg.spin && deadline != LLONG_MAX ? deadline - rt_cfg.spin : deadline, &ts));
+            while (rt_cfg.spin && spsc_bell_seq(&io_bell) == seq && get_us() < deadline)
+                spin_pause();
+            wake_sample(deadline);
+            continue;
         }
+#endif
+        phl_events = phl_sleep(next_deadline());
     }
 }
 
@@ -15,6 +15,13 @@ extern "C" {
 
 #include "lprintf.h"
 
+/* Per-station storage: in-process runs keep each station on its own thread */
+#ifdef _MSC_VER
+#define STATION_LOCAL __declspec(thread)
+#else
+#define STATION_LOCAL __thread
+#endif
+
 /* Initalization */ 
 extern void protocol_init(int argc, char **argv);
 
@@ -27,6 +34,9 @@ extern int wait_for_event(int *arg);
 #define DATA_TIMEOUT         3
 #define ACK_TIMEOUT          4
 
+/* *arg of DATA_TIMEOUT is the timer No., of ACK_TIMEOUT this, which no data timer has */
+#define ACK_TIMER_NR (-1)
+
 /* Network Layer functions */
 #define PKT_LEN 256
 
@@ -44,13 +54,18 @@ extern int  phl_sq_len(void);
 /* CRC-32 polynomium coding function */
 extern unsigned int crc32(unsigned char *buf, int len);
 
-/* Timer Management functions */
+/* Timer Management functions: any No. below INT_MAX, up to 2^24 running at once */
 extern unsigned int get_ms(void);
 extern void start_timer(unsigned int nr, unsigned int ms);
 extern void stop_timer(unsigned int nr);
 extern void start_ack_timer(unsigned int ms);
 extern void stop_ack_timer(void);
 
+/* The same at microsecond resolution, on the monotonic clock get_ms() reads */
+extern long long get_us(void);
+extern void start_timer_us(unsigned int nr, long long us);
+extern void start_ack_timer_us(long long us);
+
 /* Protocol Debugger */
 extern char *station_name(void);
 
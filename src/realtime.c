@@ -0,0 +1,150 @@
+/*
+    Low-jitter execution of a station process
+
+    A station that sleeps until its next deadline is only as punctual as
+    the scheduler lets it be: on a loaded host a wakeup can come tens of
+    milliseconds late and the pacer, the timers and the committed bytes
+    all slip with it. SCHED_FIFO (or a lower nice level) lets the thread
+    preempt the load, a CPU of its own keeps its caches and spares it
+    migrations, and mlockall() keeps page faults out of the loop. The
+    busy-poll window is applied by the caller, which knows its deadlines.
+
+    Settings the kernel refuses, mostly for lack of CAP_SYS_NICE or
+    RLIMIT_MEMLOCK, are reported and the run goes on without them.
+*/
+
+#ifndef _WIN32
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "realtime.h"
+
+#define RT_FIFO_PRIO 50 /* mid-range, where threaded interrupts run by default */
+#define RT_MAX_SPIN 100000
+
+void rt_init(struct RT_CONFIG *cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->cpu[0] = cfg->cpu[1] = -1;
+}
+
+/* a decimal in [lo, hi], the whole of 'str' */
+static int rt_int(const char *str, int lo, int hi, int *v)
+{
+    char *end;
+    long n = strtol(str, &end, 10);
+
+    if (end == str || *end || n < lo || n > hi)
+        return -1;
+    *v = (int)n;
+    return 0;
+}
+
+int rt_parse(struct RT_CONFIG *cfg, const char *spec)
+{
+    char buf[256], *item, *arg, *plus;
+    int ncpu = (int)sysconf(_SC_NPROCESSORS_CONF);
+
+    if (strlen(spec) >= sizeof(buf))
+        return -1;
+    strcpy(buf, spec);
+
+    for (item = strtok(buf, ","); item; item = strtok(NULL, ",")) {
+        if ((arg = strchr(item, '=')) != NULL)
+            *arg++ = 0;
+
+        if (strcasecmp(item, "fifo") == 0) {
+            cfg->fifo = RT_FIFO_PRIO;
+            if (arg && rt_int(arg, sched_get_priority_min(SCHED_FIFO), sched_get_priority_max(SCHED_FIFO), &cfg->fifo) < 0)
+                return -1;
+        } else if (strcasecmp(item, "lock") == 0 && arg == NULL)
+            cfg->lock = 1;
+        else if (arg == NULL)
+            return -1;
+        else if (strcasecmp(item, "nice") == 0) {
+            if (rt_int(arg, -20, 19, &cfg->nice) < 0)
+                return -1;
+            cfg->renice = 1;
+        } else if (strcasecmp(item, "cpu") == 0) {
+            if ((plus = strchr(arg, '+')) != NULL) {
+                *plus++ = 0;
+                if (rt_int(plus, 0, ncpu - 1, &cfg->cpu[1]) < 0)
+                    return -1;
+            }
+            if (rt_int(arg, 0, ncpu - 1, &cfg->cpu[0]) < 0)
+                return -1;
+        } else if (strcasecmp(item, "spin") == 0) {
+            if (rt_int(arg, 0, RT_MAX_SPIN, &cfg->spin) < 0)
+                return -1;
+        } else
+            return -1;
+    }
+
+    cfg->active = 1;
+    return 0;
+}
+
+const char *rt_apply(const struct RT_CONFIG *cfg, int thread, char *buf)
+{
+    struct sched_param sp;
+    cpu_set_t set;
+
+    buf[0] = 0;
+
+    /* the whole process, once */
+    if (cfg->lock && thread == 0 && mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+        strcat(buf, ", mlockall()");
+
+    if (cfg->fifo) {
+        memset(&sp, 0, sizeof(sp));
+        sp.sched_priority = cfg->fifo;
+        if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp) != 0)
+            strcat(buf, ", SCHED_FIFO");
+    } else if (cfg->renice && setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), cfg->nice) < 0)
+        strcat(buf, ", nice level"); /* a Linux thread has a nice level of its own */
+
+    if (cfg->cpu[thread] >= 0) {
+        CPU_ZERO(&set);
+        CPU_SET(cfg->cpu[thread], &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+            strcat(buf, ", CPU affinity");
+    }
+
+    return buf[0] ? buf + 2 : NULL;
+}
+
+const char *rt_describe(const struct RT_CONFIG *cfg, char *buf)
+{
+    char *p = buf;
+
+    if (cfg->fifo)
+        p += sprintf(p, "SCHED_FIFO %d", cfg->fifo);
+    else if (cfg->renice)
+        p += sprintf(p, "nice %d", cfg->nice);
+    else
+        p += sprintf(p, "normal priority");
+    if (cfg->cpu[0] >= 0)
+        p += sprintf(p, ", CPU %d", cfg->cpu[0]);
+    if (cfg->cpu[1] >= 0)
+        p += sprintf(p, ", I/O thread on CPU %d", cfg->cpu[1]);
+    if (cfg->lock)
+        p += sprintf(p, ", memory locked");
+    if (cfg->spin)
+        p += sprintf(p, ", %d us busy-polled before a deadline", cfg->spin);
+    return buf;
+}
+
+#endif
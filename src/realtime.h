@@ -0,0 +1,38 @@
+#ifndef __REALTIME_H__
+#define __REALTIME_H__
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Low-jitter execution of the threads of a station: real-time or nice
+ * priority, a CPU of their own and memory locked against paging.
+ */
+struct RT_CONFIG {
+    int active;
+    int fifo;     /* SCHED_FIFO priority, 0 for the normal policy */
+    int renice;   /* set the nice level below under the normal policy */
+    int nice;
+    int cpu[2];   /* CPU of the protocol thread and of the I/O thread, -1: any */
+    int lock;     /* mlockall() */
+    int spin;     /* us busy-polled before a deadline instead of sleeping */
+};
+
+/* Defaults: nothing changed */
+extern void rt_init(struct RT_CONFIG *cfg);
+
+/* Parse "fifo[=<prio>],nice=<n>,cpu=<n>[+<m>],lock,spin=<us>" in any order, -1 on errors */
+extern int rt_parse(struct RT_CONFIG *cfg, const char *spec);
+
+/* Put the calling thread, 0 for the protocol and 1 for the I/O thread, under 'cfg'; NULL, or in 'buf' what was refused */
+extern const char *rt_apply(const struct RT_CONFIG *cfg, int thread, char *buf);
+
+/* One-line description of the configuration */
+extern const char *rt_describe(const struct RT_CONFIG *cfg, char *buf);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,174 @@
+/*
+    Recording of the physical-layer byte stream
+
+    A recording starts with a header of the settings it was made with,
+    numbers as varints and option strings as a varint length and the
+    bytes, followed by records of one type byte, the time as a zigzag
+    varint delta from the record before, the length as a varint and the
+    bytes.
+    Blocks are recorded after bit errors are imposed, so a replay feeds
+    a station exactly what it received without running the channel.
+*/
+
+#include <string.h>
+
+#include "record.h"
+
+#define REC_MAGIC "DLREC\0\0\4"
+#define REC_NINFO 10
+
+static void rec_varint(FILE *fp, unsigned int v)
+{
+    while (v >= 0x80) {
+        putc((int)(v & 0x7f) | 0x80, fp);
+        v >>= 7;
+    }
+    putc((int)v, fp);
+}
+
+static void rec_string(FILE *fp, const char *str)
+{
+    rec_varint(fp, (unsigned int)strlen(str));
+    fputs(str, fp);
+}
+
+/* -1 at the end of the file */
+static long long rec_read_varint(FILE *fp)
+{
+    unsigned int v = 0;
+    int c, shift;
+
+    for (shift = 0; shift < 35; shift += 7) {
+        if ((c = getc(fp)) == EOF)
+            return -1;
+        v |= (unsigned int)(c & 0x7f) << shift;
+        if (!(c & 0x80))
+            return v;
+    }
+    return -1;
+}
+
+/* -1 at the end of the file, or if it does not fit in 'size' bytes with its terminator */
+static int rec_read_string(FILE *fp, char *buf, int size)
+{
+    long long len = rec_read_varint(fp);
+
+    if (len < 0 || len >= size || fread(buf, 1, (size_t)len, fp) != (size_t)len)
+        return -1;
+    buf[len] = 0;
+    return 0;
+}
+
+int rec_create(struct RECORDER *rec, const char *fname, const struct REC_INFO *info)
+{
+    unsigned int v[REC_NINFO];
+    int i;
+
+    memset(rec, 0, sizeof(*rec));
+    if ((rec->fp = fopen(fname, "wb")) == NULL)
+        return -1;
+
+    v[0] = info->station;
+    v[1] = info->linecode;
+    v[2] = info->bps;
+    v[3] = info->delay;
+    v[4] = info->tick;
+    v[5] = info->life;
+    v[6] = info->seed;
+    v[7] = info->flood;
+    v[8] = info->ibib;
+    v[9] = info->queue;
+
+    fwrite(REC_MAGIC, 1, 8, rec->fp);
+    for (i = 0; i < REC_NINFO; i++)
+        rec_varint(rec->fp, v[i]);
+    rec_string(rec->fp, info->netem);
+    rec_string(rec->fp, info->schedule);
+    rec_string(rec->fp, info->traffic);
+    return 0;
+}
+
+void rec_put(struct RECORDER *rec, int type, int ts, const unsigned char *data, int len)
+{
+    int delta = ts - rec->ts;
+
+    putc(type, rec->fp);
+    rec_varint(rec->fp, ((unsigned int)delta << 1) ^ (unsigned int)(delta >> 31)); /* zigzag */
+    rec_varint(rec->fp, (unsigned int)len);
+    fwrite(data, 1, len, rec->fp);
+    rec->ts = ts;
+    rec->bytes += len;
+}
+
+void rec_close(struct RECORDER *rec)
+{
+    if (rec->fp) {
+        fclose(rec->fp);
+        rec->fp = NULL;
+    }
+}
+
+int rec_open(struct RECORDER *rec, const char *fname, struct REC_INFO *info)
+{
+    char magic[8];
+    long long v[REC_NINFO];
+    int i;
+
+    memset(rec, 0, sizeof(*rec));
+    if ((rec->fp = fopen(fname, "rb")) == NULL)
+        return -1;
+
+    if (fread(magic, 1, 8, rec->fp) != 8 || memcmp(magic, REC_MAGIC, 8) != 0)
+        goto bad;
+    for (i = 0; i < REC_NINFO; i++) {
+        if ((v[i] = rec_read_varint(rec->fp)) < 0)
+            goto bad;
+    }
+
+    info->station = (int)v[0];
+    info->linecode = (int)v[1];
+    info->bps = (int)v[2];
+    info->delay = (int)v[3];
+    info->tick = (int)v[4];
+    info->life = (int)v[5];
+    info->seed = (unsigned int)v[6];
+    info->flood = (int)v[7];
+    info->ibib = (int)v[8];
+    info->queue = (int)v[9];
+    if (rec_read_string(rec->fp, info->netem, sizeof(info->netem)) < 0
+        || rec_read_string(rec->fp, info->schedule, sizeof(info->schedule)) < 0
+        || rec_read_string(rec->fp, info->traffic, sizeof(info->traffic)) < 0)
+        goto bad;
+    if (info->station != 'a' && info->station != 'b')
+        goto bad;
+    return 0;
+
+bad:
+    rec_close(rec);
+    return -1;
+}
+
+int rec_get(struct RECORDER *rec, int type, int *ts, unsigned char *buf, int size)
+{
+    long long delta, len;
+    int t;
+
+    while (rec->fp && (t = getc(rec->fp)) != EOF) {
+        if ((delta = rec_read_varint(rec->fp)) < 0 || (len = rec_read_varint(rec->fp)) < 0)
+            break;
+        rec->ts += (int)((unsigned int)delta >> 1) ^ -(int)(delta & 1); /* zigzag */
+
+        if (t != type || len > size) {
+            /* records of the other type, and any too long for the caller, are skipped */
+            if (fseek(rec->fp, (long)len, SEEK_CUR) != 0)
+                break;
+            continue;
+        }
+        if (fread(buf, 1, (size_t)len, rec->fp) != (size_t)len)
+            break;
+        *ts = rec->ts;
+        rec->bytes += len;
+        return (int)len;
+    }
+    return -1;
+}
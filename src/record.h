@@ -0,0 +1,50 @@
+#ifndef __RECORD_H__
+#define __RECORD_H__
+
+#include <stdio.h>
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/* Records of a physical-layer recording */
+#define REC_BLOCK 1 /* received line bytes, at their commit time */
+#define REC_FRAME 2 /* frame handed to the physical layer, at the time sent */
+
+/* Settings a recording was made with, restored on replay */
+struct REC_INFO {
+    int station; /* 'a' or 'b' */
+    int linecode;
+    int bps, delay, tick, life; /* line rate, propagation delay, tick and time-to-live (ms) */
+    unsigned int seed;
+    int flood, ibib;
+    int queue; /* sending queue (bytes) */
+    char netem[256]; /* --netem as given, "" for none */
+    char schedule[1024]; /* --schedule file, "" for none, read again on replay */
+    char traffic[1024]; /* --traffic as given, "" for the default, a trace read again on replay */
+};
+
+struct RECORDER {
+    FILE *fp;
+    int ts;                   /* time of the last record read or written */
+    unsigned long long bytes; /* recorded so far */
+};
+
+/* Create a recording, -1 on errors */
+extern int rec_create(struct RECORDER *rec, const char *fname, const struct REC_INFO *info);
+
+extern void rec_put(struct RECORDER *rec, int type, int ts, const unsigned char *data, int len);
+
+extern void rec_close(struct RECORDER *rec);
+
+/* Open a recording for replay and read its settings, -1 on errors */
+extern int rec_open(struct RECORDER *rec, const char *fname, struct REC_INFO *info);
+
+/* Next record of 'type', skipping the others: length, time in 'ts', -1 at the end */
+extern int rec_get(struct RECORDER *rec, int type, int *ts, unsigned char *buf, int size);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
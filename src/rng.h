@@ -0,0 +1,71 @@
+#ifndef __RNG_H__
+#define __RNG_H__
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/*
+ * xoshiro256** random number streams. A stream is seeded from the run
+ * seed and a stream number through splitmix64, so every stream of every
+ * station is independent and a run replays exactly from its seed.
+ */
+
+struct RNG {
+    unsigned long long s[4];
+};
+
+static inline unsigned long long rng_rotl(unsigned long long x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+static inline unsigned long long rng_splitmix(unsigned long long *x)
+{
+    unsigned long long z = (*x += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static inline void rng_seed(struct RNG *rng, unsigned long long seed, unsigned int stream)
+{
+    unsigned long long x = seed ^ ((unsigned long long)stream << 32 | stream) * 0xd1b54a32d192ed03ULL;
+    int i;
+
+    for (i = 0; i < 4; i++)
+        rng->s[i] = rng_splitmix(&x);
+}
+
+static inline unsigned long long rng_next(struct RNG *rng)
+{
+    unsigned long long *s = rng->s;
+    unsigned long long result = rng_rotl(s[1] * 5, 7) * 9, t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rng_rotl(s[3], 45);
+    return result;
+}
+
+/* uniform in (0, 1], 53 bits */
+static inline double rng_uniform(struct RNG *rng)
+{
+    return ((rng_next(rng) >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+/* uniform in [0, n) */
+static inline unsigned int rng_below(struct RNG *rng, unsigned int n)
+{
+    return (unsigned int)(((rng_next(rng) >> 32) * n) >> 32);
+}
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
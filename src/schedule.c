@@ -0,0 +1,160 @@
+/*
+    Time-varying channel schedules
+
+    A schedule file lists changes of rate, delay and bit error rate per
+    direction, e.g.
+
+        # seconds  direction  settings
+        0          ab         rate=64k
+        0          ba         rate=8k delay=300
+        30         both       ber=1e-4
+        45         both       ber=1e-5 rate=2k
+
+    Each station applies the changes of the direction it sends on to its
+    pacer and those of the direction it receives on to its delay and
+    noise, at the scheduled instants.
+*/
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "schedule.h"
+
+#ifdef _WIN32
+#define strcasecmp _stricmp
+#else
+#include <strings.h>
+#endif
+
+#define SCH_LINE 1024
+
+static int sch_count(const char *str, double *v)
+{
+    char *end;
+
+    *v = strtod(str, &end);
+    switch (tolower((unsigned char)*end)) {
+    case 'k':
+        *v *= 1e3, end++;
+        break;
+    case 'm':
+        *v *= 1e6, end++;
+        break;
+    case 'g':
+        *v *= 1e9, end++;
+        break;
+    }
+    return end == str || *end ? -1 : 0;
+}
+
+static int sch_parse(struct SCH_ENTRY *e, char *line)
+{
+    char *tok, *arg, *end;
+    double v;
+
+    if ((tok = strtok(line, " \t")) == NULL)
+        return -1;
+    v = strtod(tok, &end);
+    if (end == tok || *end || v < 0 || v > 2e6)
+        return -1;
+    e->at = (int)(v * 1000 + 0.5);
+
+    if ((tok = strtok(NULL, " \t")) == NULL)
+        return -1;
+    if (strcasecmp(tok, "ab") == 0)
+        e->dirs = SCH_AB;
+    else if (strcasecmp(tok, "ba") == 0)
+        e->dirs = SCH_BA;
+    else if (strcasecmp(tok, "both") == 0)
+        e->dirs = SCH_AB | SCH_BA;
+    else
+        return -1;
+
+    e->rate = 0;
+    e->delay = -1;
+    e->ber = -1;
+    while ((tok = strtok(NULL, " \t")) != NULL) {
+        if ((arg = strchr(tok, '=')) == NULL)
+            return -1;
+        *arg++ = 0;
+        if (strcasecmp(tok, "rate") == 0) {
+            if (sch_count(arg, &v) < 0 || v < 100 || v > 1e9)
+                return -1;
+            e->rate = (int)v;
+        } else if (strcasecmp(tok, "delay") == 0) {
+            v = strtod(arg, &end);
+            if (end == arg || *end || v < 0 || v > 60000)
+                return -1;
+            e->delay = (int)v;
+        } else if (strcasecmp(tok, "ber") == 0) {
+            v = strtod(arg, &end);
+            if (end == arg || *end || v < 0 || v >= 1.0)
+                return -1;
+            e->ber = v;
+        } else
+            return -1;
+    }
+    return 0;
+}
+
+int sch_load(struct SCHEDULE *sch, const char *fname)
+{
+    char line[SCH_LINE], *p;
+    struct SCH_ENTRY e, *grown;
+    FILE *fp;
+    int lineno = 0, size = 0, i;
+
+    if ((fp = fopen(fname, "r")) == NULL)
+        return -1;
+
+    sch->e = NULL;
+    sch->n = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        lineno++;
+        if ((p = strchr(line, '#')) != NULL)
+            *p = 0;
+        line[strcspn(line, "\r\n")] = 0;
+        for (p = line; isspace((unsigned char)*p); p++)
+            ;
+        if (*p == 0)
+            continue;
+
+        if (sch_parse(&e, p) < 0) {
+            fclose(fp);
+            return lineno;
+        }
+
+        if (sch->n == size) {
+            size = size ? size * 2 : 16;
+            if ((grown = (struct SCH_ENTRY *)realloc(sch->e, size * sizeof(e))) == NULL) {
+                fclose(fp);
+                return -1;
+            }
+            sch->e = grown;
+        }
+
+        /* insertion keeps changes of the same instant in file order */
+        for (i = sch->n; i > 0 && sch->e[i - 1].at > e.at; i--)
+            sch->e[i] = sch->e[i - 1];
+        sch->e[i] = e;
+        sch->n++;
+    }
+    fclose(fp);
+    return 0;
+}
+
+const char *sch_describe(const struct SCH_ENTRY *e, char *buf)
+{
+    char *p = buf;
+
+    p += sprintf(p, "%s", e->dirs == SCH_AB ? "A->B" : e->dirs == SCH_BA ? "B->A" : "both directions");
+    if (e->rate)
+        p += sprintf(p, ", %d bps", e->rate);
+    if (e->delay >= 0)
+        p += sprintf(p, ", %d ms delay", e->delay);
+    if (e->ber >= 0)
+        p += sprintf(p, ", BER %.1E", e->ber);
+    return buf;
+}
@@ -0,0 +1,40 @@
+#ifndef __SCHEDULE_H__
+#define __SCHEDULE_H__
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/* Directions of the channel */
+#define SCH_AB 0x01 /* station A to station B */
+#define SCH_BA 0x02 /* station B to station A */
+
+/* Settings of one or both directions from instant 'at' on */
+struct SCH_ENTRY {
+    int at;      /* ms */
+    int dirs;    /* SCH_AB | SCH_BA */
+    int rate;    /* bps, 0: unchanged */
+    int delay;   /* ms, -1: unchanged */
+    double ber;  /* -1: unchanged */
+};
+
+struct SCHEDULE {
+    struct SCH_ENTRY *e; /* by time, file order within the same instant */
+    int n;
+};
+
+/*
+ * Read a schedule, one change per line: "<seconds> <ab|ba|both> <key>=<value> ..."
+ * with keys rate (k/M/G suffix allowed), delay (ms) and ber; '#' starts a comment.
+ * Return 0, the number of the first bad line, or -1 if the file can't be read.
+ */
+extern int sch_load(struct SCHEDULE *sch, const char *fname);
+
+/* One-line description of what an entry changes */
+extern const char *sch_describe(const struct SCH_ENTRY *e, char *buf);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
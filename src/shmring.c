@@ -0,0 +1,218 @@
+/*
+    Shared-memory line between two station processes
+
+    Station A creates a POSIX shared memory object holding one byte ring
+    per direction; station B maps it by name. Each ring has exactly one
+    producer and one consumer, so head and tail are plain free-running
+    counters published with acquire/release ordering and no lock is
+    needed. A station about to sleep announces it and waits on its own
+    doorbell futex; the peer rings the doorbell when it adds bytes, frees
+    room or leaves, and only enters the kernel when someone is asleep.
+*/
+
+#ifndef _WIN32
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "shmring.h"
+
+#define SHR_MAGIC 0x52494e47
+#define SHR_SIZE (64 * 1024) /* bytes per ring, a power of 2 */
+
+struct SHR_RING {
+    unsigned int tail; /* bytes ever written, owned by the producer */
+    char pad1[60];
+    unsigned int head; /* bytes ever read, owned by the consumer */
+    char pad2[60];
+    unsigned char data[SHR_SIZE];
+};
+
+struct SHR_AREA {
+    unsigned int magic; /* set last by the creator */
+    unsigned int attached;
+    long long epoch; /* us on the monotonic clock both stations read, set by the peer as it attaches */
+    unsigned int bell[2]; /* doorbell futex of each station */
+    unsigned int sleeping[2]; /* what a sleeping station waits for, SHR_INPUT/SHR_ROOM */
+    unsigned int gone[2];
+    struct SHR_RING ring[2]; /* ring[i] carries bytes to station i */
+};
+
+static struct SHR_AREA *shr;
+static int shr_me; /* 0: creator, 1: attached peer */
+static unsigned int shr_kicked; /* shr_kick() since the last shr_wait() */
+
+static long futex(unsigned int *addr, int op, unsigned int val, const struct timespec *timeout)
+{
+    return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+/* Tell station 'to' about 'what' has happened, waking it only if it waits for that */
+static void shr_ring_bell(int to, int what)
+{
+    __atomic_add_fetch(&shr->bell[to], 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&shr->sleeping[to], __ATOMIC_SEQ_CST) & what)
+        futex(&shr->bell[to], FUTEX_WAKE, 1, NULL);
+}
+
+static void shr_close(void)
+{
+    __atomic_store_n(&shr->gone[shr_me], 1, __ATOMIC_SEQ_CST);
+    shr_ring_bell(!shr_me, SHR_INPUT | SHR_ROOM);
+}
+
+static struct SHR_AREA *shr_map(int fd)
+{
+    void *p = mmap(NULL, sizeof(struct SHR_AREA), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    close(fd);
+    return p == MAP_FAILED ? NULL : (struct SHR_AREA *)p;
+}
+
+int shr_create(const char *name, long long *epoch)
+{
+    int fd;
+
+    shm_unlink(name); /* left over by a crashed run */
+    if ((fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600)) < 0)
+        return -1;
+    if (ftruncate(fd, sizeof(struct SHR_AREA)) < 0 || (shr = shr_map(fd)) == NULL) {
+        shm_unlink(name);
+        return -1;
+    }
+
+    shr_me = 0;
+    __atomic_store_n(&shr->magic, SHR_MAGIC, __ATOMIC_RELEASE);
+
+    while (__atomic_load_n(&shr->attached, __ATOMIC_ACQUIRE) == 0)
+        futex(&shr->attached, FUTEX_WAIT, 0, NULL);
+    *epoch = shr->epoch;
+
+    /* both stations have it mapped, the name is no longer needed */
+    shm_unlink(name);
+    atexit(shr_close);
+    return 0;
+}
+
+int shr_attach(const char *name, long long epoch)
+{
+    struct stat st;
+    int fd;
+
+    if ((fd = shm_open(name, O_RDWR, 0600)) < 0)
+        return -1;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(struct SHR_AREA) || (shr = shr_map(fd)) == NULL) {
+        close(fd);
+        return -1;
+    }
+    if (__atomic_load_n(&shr->magic, __ATOMIC_ACQUIRE) != SHR_MAGIC) {
+        munmap(shr, sizeof(struct SHR_AREA));
+        shr = NULL;
+        return -1;
+    }
+
+    shr_me = 1;
+    shr->epoch = epoch;
+    __atomic_store_n(&shr->attached, 1, __ATOMIC_RELEASE);
+    futex(&shr->attached, FUTEX_WAKE, 1, NULL);
+    atexit(shr_close);
+    return 0;
+}
+
+int shr_send(const unsigned char *buf, int n)
+{
+    struct SHR_RING *r = &shr->ring[!shr_me];
+    unsigned int tail = r->tail, head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    unsigned int off = tail % SHR_SIZE;
+    int room = SHR_SIZE - (int)(tail - head), n1;
+
+    if (n > room)
+        n = room;
+    if (n <= 0)
+        return 0;
+
+    n1 = SHR_SIZE - off < (unsigned int)n ? (int)(SHR_SIZE - off) : n;
+    memcpy(r->data + off, buf, n1);
+    memcpy(r->data, buf + n1, n - n1);
+    __atomic_store_n(&r->tail, tail + n, __ATOMIC_SEQ_CST);
+
+    shr_ring_bell(!shr_me, SHR_INPUT);
+    return n;
+}
+
+int shr_recv(unsigned char *buf, int n)
+{
+    struct SHR_RING *r = &shr->ring[shr_me];
+    unsigned int head = r->head, tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    unsigned int off = head % SHR_SIZE;
+    int n1;
+
+    if (n > (int)(tail - head))
+        n = (int)(tail - head);
+    if (n == 0)
+        return __atomic_load_n(&shr->gone[!shr_me], __ATOMIC_SEQ_CST) ? -1 : 0;
+
+    n1 = SHR_SIZE - off < (unsigned int)n ? (int)(SHR_SIZE - off) : n;
+    memcpy(buf, r->data + off, n1);
+    memcpy(buf + n1, r->data, n - n1);
+    __atomic_store_n(&r->head, head + n, __ATOMIC_SEQ_CST);
+
+    /* a full ring may have stalled the peer */
+    if (tail - head == SHR_SIZE)
+        shr_ring_bell(!shr_me, SHR_ROOM);
+    return n;
+}
+
+static int shr_ready(int want)
+{
+    struct SHR_RING *rx = &shr->ring[shr_me], *tx = &shr->ring[!shr_me];
+    int ready = 0;
+
+    if ((want & SHR_INPUT) && (__atomic_load_n(&rx->tail, __ATOMIC_SEQ_CST) != rx->head
+                                  || __atomic_load_n(&shr->gone[!shr_me], __ATOMIC_SEQ_CST)))
+        ready |= SHR_INPUT;
+    if ((want & SHR_ROOM) && tx->tail - __atomic_load_n(&tx->head, __ATOMIC_SEQ_CST) < SHR_SIZE)
+        ready |= SHR_ROOM;
+    return ready;
+}
+
+int shr_wait(const struct timespec *timeout, int want)
+{
+    static const struct timespec zero = { 0, 0 };
+    unsigned int bell;
+    int ready;
+
+    __atomic_store_n(&shr->sleeping[shr_me], want, __ATOMIC_SEQ_CST);
+    bell = __atomic_load_n(&shr->bell[shr_me], __ATOMIC_SEQ_CST);
+
+    ready = shr_ready(want);
+    if (__atomic_exchange_n(&shr_kicked, 0, __ATOMIC_SEQ_CST))
+        timeout = &zero;
+    if (ready == 0 && (timeout == NULL || timeout->tv_sec || timeout->tv_nsec)) {
+        futex(&shr->bell[shr_me], FUTEX_WAIT, bell, timeout);
+        ready = shr_ready(want);
+    }
+
+    __atomic_store_n(&shr->sleeping[shr_me], 0, __ATOMIC_SEQ_CST);
+    return ready;
+}
+
+void shr_kick(void)
+{
+    __atomic_store_n(&shr_kicked, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&shr->bell[shr_me], 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&shr->sleeping[shr_me], __ATOMIC_SEQ_CST))
+        futex(&shr->bell[shr_me], FUTEX_WAKE, 1, NULL);
+}
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef __SHMRING_H__
+#define __SHMRING_H__
+
+#include <time.h>
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Shared-memory line between two station processes: one single-producer
+ * single-consumer byte ring per direction in a POSIX shared memory
+ * object, with futex wakeups.
+ */
+
+/* Create the object 'name' (station A), wait until the peer attaches and read the run's 'epoch' it left */
+extern int shr_create(const char *name, long long *epoch);
+
+/* Attach to the object 'name' (station B) and leave the run's 'epoch' there, -1 if it is not there yet */
+extern int shr_attach(const char *name, long long epoch);
+
+/* Queue up to 'n' bytes for the peer, return the bytes taken */
+extern int shr_send(const unsigned char *buf, int n);
+
+/* Take up to 'n' bytes, return the bytes copied, -1 once the peer is gone and the ring drained */
+extern int shr_recv(unsigned char *buf, int n);
+
+#define SHR_INPUT 0x01
+#define SHR_ROOM 0x02
+
+/* Sleep at most 'timeout' (NULL: forever) until the wanted SHR_INPUT/SHR_ROOM, return what is there */
+extern int shr_wait(const struct timespec *timeout, int want);
+
+/* From another thread: make the shr_wait() in progress, or the next one, return at once */
+extern void shr_kick(void);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
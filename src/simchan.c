@@ -0,0 +1,317 @@
+/*
+    In-process channel with a virtual clock
+
+    Each station runs as a thread. Only the station holding the turn
+    runs; when it goes to sleep, the turn passes to the station due
+    first (earliest deadline, or pending input it is waiting for; ties
+    go to the lower station index) and the clock jumps to that instant.
+    The run is therefore deterministic and takes no wall-clock time
+    while nothing happens.
+
+    On the real-time clock the stations run concurrently, sleep on
+    CLOCK_MONOTONIC and a write wakes the peer if it waits for input.
+
+    Bytes written for a later instant stay in flight, ordered by
+    arrival, and land in the receiver's ring when their time comes; a
+    station waiting for input is due at its first landing.
+*/
+
+#ifndef _WIN32
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "simchan.h"
+
+struct SC_CHUNK {
+    int at; /* ms the bytes land */
+    int n;
+    struct SC_CHUNK *link;
+    unsigned char data[];
+};
+
+struct SC_STATION {
+    int deadline; /* wakeup asked for */
+    int want_input; /* also wake up on arriving bytes */
+    int done;
+    pthread_cond_t turn;
+    unsigned char *buf; /* inbound bytes, a ring growing on demand */
+    int head, len, size;
+    struct SC_CHUNK *flight, *flight_tail; /* inbound bytes not landed yet, by time */
+};
+
+static struct SC_STATION *sc;
+static int sc_n;
+static int sc_turn; /* station allowed to run */
+static int sc_clock = 1; /* ms, 0 reads as 'unset' to the pacer */
+static int sc_realtime; /* stations run concurrently on the wall clock */
+static struct timespec sc_base; /* CLOCK_MONOTONIC at 1 ms of real time */
+static pthread_mutex_t sc_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread int sc_me;
+
+void sc_init(int nstation, int realtime)
+{
+    pthread_condattr_t attr;
+    int i;
+
+    sc = (struct SC_STATION *)calloc(nstation, sizeof(struct SC_STATION));
+    if (sc == NULL) {
+        printf("No enough memory\n");
+        exit(0);
+    }
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    for (i = 0; i < nstation; i++)
+        pthread_cond_init(&sc[i].turn, &attr);
+    pthread_condattr_destroy(&attr);
+    sc_n = nstation;
+    sc_turn = 0;
+    sc_realtime = realtime;
+    clock_gettime(CLOCK_MONOTONIC, &sc_base);
+}
+
+void sc_enter(int idx)
+{
+    pthread_mutex_lock(&sc_lock);
+    sc_me = idx;
+    while (!sc_realtime && sc_turn != sc_me)
+        pthread_cond_wait(&sc[sc_me].turn, &sc_lock);
+    pthread_mutex_unlock(&sc_lock);
+}
+
+int sc_now(void)
+{
+    struct timespec ts;
+
+    if (!sc_realtime)
+        return sc_clock;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int)((ts.tv_sec - sc_base.tv_sec) * 1000 + (ts.tv_nsec - sc_base.tv_nsec) / 1000000) + 1;
+}
+
+/* ms of the clock the stations share */
+static int sc_time(void)
+{
+    return sc_realtime ? sc_now() : sc_clock;
+}
+
+static int sc_due(struct SC_STATION *s)
+{
+    if (s->done)
+        return INT_MAX;
+    if (s->want_input && (s->len > 0 || (s->flight && s->flight->at <= sc_clock)))
+        return sc_clock;
+    if (s->want_input && s->flight && s->flight->at < s->deadline)
+        return s->flight->at;
+    return s->deadline;
+}
+
+/* Hand the turn to the station due first, with the lock held */
+static void sc_schedule(void)
+{
+    int i, best = 0, t;
+
+    for (i = 1; i < sc_n; i++) {
+        if (sc_due(&sc[i]) < sc_due(&sc[best]))
+            best = i;
+    }
+
+    t = sc_due(&sc[best]);
+    if (t == INT_MAX)
+        exit(0); /* every station is done */
+    if (t > sc_clock)
+        sc_clock = t;
+
+    sc_turn = best;
+    pthread_cond_signal(&sc[best].turn);
+}
+
+/* Append bytes to the ring of 's', with the lock held; 0 if out of memory */
+static int sc_append(struct SC_STATION *s, const unsigned char *buf, int n)
+{
+    int tail, n1;
+
+    if (s->len + n > s->size) {
+        /* grow and straighten the ring */
+        int size = s->size ? s->size : 64 * 1024;
+        unsigned char *nbuf;
+
+        while (size < s->len + n)
+            size *= 2;
+        if ((nbuf = (unsigned char *)malloc(size)) == NULL)
+            return 0;
+        n1 = s->size - s->head < s->len ? s->size - s->head : s->len;
+        if (s->len) {
+            memcpy(nbuf, s->buf + s->head, n1);
+            memcpy(nbuf + n1, s->buf, s->len - n1);
+        }
+        free(s->buf);
+        s->buf = nbuf;
+        s->head = 0;
+        s->size = size;
+    }
+
+    tail = (s->head + s->len) % s->size;
+    n1 = s->size - tail < n ? s->size - tail : n;
+    memcpy(s->buf + tail, buf, n1);
+    memcpy(s->buf, buf + n1, n - n1);
+    s->len += n;
+    return n;
+}
+
+/* Move the bytes in flight that are due into the ring, with the lock held */
+static void sc_land(struct SC_STATION *s)
+{
+    struct SC_CHUNK *c;
+    int t = sc_time();
+
+    while ((c = s->flight) != NULL && c->at <= t) {
+        sc_append(s, c->data, c->n);
+        s->flight = c->link;
+        free(c);
+    }
+}
+
+int sc_wait(int deadline, int want_input)
+{
+    struct SC_STATION *me = &sc[sc_me];
+    int ready, t;
+
+    pthread_mutex_lock(&sc_lock);
+    me->deadline = deadline;
+    me->want_input = want_input;
+    if (sc_realtime) {
+        struct timespec ts;
+        long long ns;
+
+        for (;;) {
+            sc_land(me);
+            t = want_input && me->flight && me->flight->at < deadline ? me->flight->at : deadline;
+            if ((want_input && me->len > 0) || (t != INT_MAX && sc_now() >= t))
+                break;
+            if (t == INT_MAX) {
+                pthread_cond_wait(&me->turn, &sc_lock);
+                continue;
+            }
+
+            /* a write may land earlier than this, it signals us to look again */
+            ns = (long long)(t - 1) * 1000000;
+            ts.tv_sec = sc_base.tv_sec + (time_t)(ns / 1000000000);
+            ts.tv_nsec = sc_base.tv_nsec + (long)(ns % 1000000000);
+            if (ts.tv_nsec >= 1000000000) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&me->turn, &sc_lock, &ts);
+        }
+        me->want_input = 0;
+    } else {
+        sc_schedule();
+        while (sc_turn != sc_me)
+            pthread_cond_wait(&me->turn, &sc_lock);
+    }
+    sc_land(me);
+    ready = me->len > 0;
+    pthread_mutex_unlock(&sc_lock);
+
+    return ready;
+}
+
+int sc_write(int to, const unsigned char *buf, int n)
+{
+    struct SC_STATION *s = &sc[to];
+
+    pthread_mutex_lock(&sc_lock);
+    n = sc_append(s, buf, n);
+    if (sc_realtime && s->want_input)
+        pthread_cond_signal(&s->turn);
+    pthread_mutex_unlock(&sc_lock);
+
+    return n;
+}
+
+int sc_write_at(int to, const unsigned char *buf, int n, int at)
+{
+    struct SC_STATION *s = &sc[to];
+    struct SC_CHUNK *c, **p;
+
+    if ((c = (struct SC_CHUNK *)malloc(sizeof(struct SC_CHUNK) + n)) == NULL)
+        return 0;
+    c->at = at;
+    c->n = n;
+    memcpy(c->data, buf, n);
+
+    pthread_mutex_lock(&sc_lock);
+    if (s->flight == NULL || s->flight_tail->at <= at) {
+        /* the usual case, arrivals in order */
+        c->link = NULL;
+        if (s->flight == NULL)
+            s->flight = c;
+        else
+            s->flight_tail->link = c;
+        s->flight_tail = c;
+    } else {
+        for (p = &s->flight; (*p)->at <= at; p = &(*p)->link)
+            ;
+        c->link = *p;
+        *p = c;
+    }
+    if (sc_realtime && s->want_input)
+        pthread_cond_signal(&s->turn);
+    pthread_mutex_unlock(&sc_lock);
+
+    return n;
+}
+
+int sc_read(unsigned char *buf, int n)
+{
+    struct SC_STATION *s = &sc[sc_me];
+    int n1;
+
+    pthread_mutex_lock(&sc_lock);
+    sc_land(s);
+    if (n > s->len)
+        n = s->len;
+    if (n == 0) {
+        pthread_mutex_unlock(&sc_lock);
+        return 0;
+    }
+    n1 = s->size - s->head < n ? s->size - s->head : n;
+    memcpy(buf, s->buf + s->head, n1);
+    memcpy(buf + n1, s->buf, n - n1);
+    s->head = s->size ? (s->head + n) % s->size : 0;
+    s->len -= n;
+    pthread_mutex_unlock(&sc_lock);
+
+    return n;
+}
+
+void sc_exit(void)
+{
+    int i;
+
+    pthread_mutex_lock(&sc_lock);
+    sc[sc_me].done = 1;
+    fflush(NULL);
+    if (sc_realtime) {
+        for (i = 0; i < sc_n && sc[i].done; i++)
+            ;
+        if (i == sc_n)
+            exit(0);
+    } else
+        sc_schedule();
+    for (;;)
+        pthread_cond_wait(&sc[sc_me].turn, &sc_lock);
+}
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef __SIMCHAN_H__
+#define __SIMCHAN_H__
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/*
+ * In-process channel: every station is a thread of one process and line
+ * bytes travel through memory. Under the virtual clock only one station
+ * runs at a time and time jumps to whichever station is due first; on
+ * the real-time clock they run concurrently.
+ */
+
+extern void sc_init(int nstation, int realtime);
+
+/* Make the calling thread station 'idx' and wait for its first turn */
+extern void sc_enter(int idx);
+
+/* Channel time in ms, starting at 1 */
+extern int sc_now(void);
+
+/* Sleep until 'deadline' or, if 'want_input', until bytes arrive; return 1 if input is pending */
+extern int sc_wait(int deadline, int want_input);
+
+/* Queue bytes for station 'to', return the bytes taken */
+extern int sc_write(int to, const unsigned char *buf, int n);
+
+/* Queue bytes for station 'to' that reach it at 'at' ms, return the bytes taken */
+extern int sc_write_at(int to, const unsigned char *buf, int n, int at);
+
+/* Take up to 'n' received bytes, return the bytes copied */
+extern int sc_read(unsigned char *buf, int n);
+
+/* The calling station is done; the last one to finish ends the process */
+extern void sc_exit(void);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,148 @@
+/*
+    Rings between the threads of a station
+
+    A ring has one producer and one consumer thread, so head and tail are
+    free-running byte counters, each written by its owner only and
+    published with sequentially consistent stores: a producer that reads
+    "asleep" right after its store cannot miss a consumer that checked
+    the ring right after announcing its sleep. A record is a 2-byte
+    length and its bytes, wrapping around the end like the rest.
+
+    The doorbell is a futex counter: the sleeper reads it, looks for work
+    and waits on the value it read, so a ring in between makes the wait
+    return at once, and a ring with nobody asleep costs no system call.
+*/
+
+#ifndef _WIN32
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <linux/futex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "spsc.h"
+
+#define SPSC_HDR 2
+
+static long futex(unsigned int *addr, int op, unsigned int val, const struct timespec *timeout)
+{
+    return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+int spsc_init(struct SPSC *q, unsigned int size)
+{
+    memset(q, 0, sizeof(*q));
+    for (q->size = 4096; q->size < size; q->size <<= 1)
+        ;
+    if ((q->data = (unsigned char *)malloc(q->size)) == NULL)
+        return -1;
+    return 0;
+}
+
+static void spsc_copy_in(struct SPSC *q, unsigned int pos, const unsigned char *buf, int n)
+{
+    unsigned int off = pos & (q->size - 1);
+    int n1 = q->size - off < (unsigned int)n ? (int)(q->size - off) : n;
+
+    memcpy(q->data + off, buf, n1);
+    memcpy(q->data, buf + n1, n - n1);
+}
+
+static void spsc_copy_out(struct SPSC *q, unsigned int pos, unsigned char *buf, int n)
+{
+    unsigned int off = pos & (q->size - 1);
+    int n1 = q->size - off < (unsigned int)n ? (int)(q->size - off) : n;
+
+    memcpy(buf, q->data + off, n1);
+    memcpy(buf + n1, q->data, n - n1);
+}
+
+int spsc_push(struct SPSC *q, const unsigned char *rec, int n)
+{
+    unsigned int tail = q->tail, head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+    unsigned int used = tail - head + SPSC_HDR + n;
+    unsigned char hdr[SPSC_HDR];
+
+    if (n <= 0 || n > 0xffff || used > q->size) {
+        q->refused++;
+        return 0;
+    }
+
+    hdr[0] = (unsigned char)n;
+    hdr[1] = (unsigned char)(n >> 8);
+    spsc_copy_in(q, tail, hdr, SPSC_HDR);
+    spsc_copy_in(q, tail + SPSC_HDR, rec, n);
+    __atomic_store_n(&q->tail, tail + SPSC_HDR + n, __ATOMIC_SEQ_CST);
+
+    q->records++;
+    q->held += used;
+    if (used > q->hiwater)
+        q->hiwater = used;
+    return 1;
+}
+
+int spsc_peek(struct SPSC *q)
+{
+    unsigned char hdr[SPSC_HDR];
+
+    if (__atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) == q->head)
+        return 0;
+    spsc_copy_out(q, q->head, hdr, SPSC_HDR);
+    return hdr[0] | hdr[1] << 8;
+}
+
+int spsc_pop(struct SPSC *q, unsigned char *buf, int size)
+{
+    int n = spsc_peek(q);
+
+    if (n == 0 || n > size)
+        return 0;
+    spsc_copy_out(q, q->head + SPSC_HDR, buf, n);
+    __atomic_store_n(&q->head, q->head + SPSC_HDR + n, __ATOMIC_SEQ_CST);
+    return n;
+}
+
+unsigned int spsc_used(struct SPSC *q)
+{
+    return __atomic_load_n(&q->tail, __ATOMIC_SEQ_CST) - __atomic_load_n(&q->head, __ATOMIC_SEQ_CST);
+}
+
+const char *spsc_describe(struct SPSC *q, char *buf)
+{
+    sprintf(buf, "%llu records, %.0f bytes held on average, %u at most of %u, %llu refused",
+        q->records, q->records ? (double)q->held / q->records : 0.0, q->hiwater, q->size, q->refused);
+    return buf;
+}
+
+unsigned int spsc_bell_seq(struct SPSC_BELL *b)
+{
+    return __atomic_load_n(&b->seq, __ATOMIC_SEQ_CST);
+}
+
+void spsc_bell_wait(struct SPSC_BELL *b, unsigned int seq, const struct timespec *timeout)
+{
+    if (timeout && timeout->tv_sec == 0 && timeout->tv_nsec == 0)
+        return;
+
+    __atomic_store_n(&b->sleeping, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&b->seq, __ATOMIC_SEQ_CST) == seq)
+        futex(&b->seq, FUTEX_WAIT_PRIVATE, seq, timeout);
+    __atomic_store_n(&b->sleeping, 0, __ATOMIC_SEQ_CST);
+}
+
+void spsc_bell_ring(struct SPSC_BELL *b)
+{
+    __atomic_add_fetch(&b->seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&b->sleeping, __ATOMIC_SEQ_CST)) {
+        b->wakes++;
+        futex(&b->seq, FUTEX_WAKE_PRIVATE, 1, NULL);
+    }
+}
+
+#endif
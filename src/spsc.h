@@ -0,0 +1,65 @@
+#ifndef __SPSC_H__
+#define __SPSC_H__
+
+#include <time.h>
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Lock-free single-producer single-consumer ring of variable-length
+ * records between two threads of a process, and a futex doorbell the
+ * consumer sleeps on.
+ */
+
+struct SPSC {
+    unsigned int tail; /* bytes ever pushed, owned by the producer */
+    char pad1[60];
+    unsigned int head; /* bytes ever popped, owned by the consumer */
+    char pad2[60];
+    unsigned int size; /* a power of 2 */
+    unsigned char *data;
+    /* occupancy, kept by the producer */
+    unsigned int hiwater; /* most bytes held at once */
+    unsigned long long records, held, refused; /* records pushed, bytes held summed over them, pushes without room */
+};
+
+/* A ring of at least 'size' bytes, -1 without memory */
+extern int spsc_init(struct SPSC *q, unsigned int size);
+
+/* Producer: queue an 'n'-byte record, 0 if the ring has no room for it */
+extern int spsc_push(struct SPSC *q, const unsigned char *rec, int n);
+
+/* Consumer: length of the next record, 0 if the ring is empty */
+extern int spsc_peek(struct SPSC *q);
+
+/* Consumer: take the next record into 'buf' of 'size' bytes, return its length, 0 if the ring is empty */
+extern int spsc_pop(struct SPSC *q, unsigned char *buf, int size);
+
+/* Bytes held, records and their headers, from either side */
+extern unsigned int spsc_used(struct SPSC *q);
+
+/* One-line occupancy report */
+extern const char *spsc_describe(struct SPSC *q, char *buf);
+
+struct SPSC_BELL {
+    unsigned int seq; /* rings so far */
+    unsigned int sleeping;
+    unsigned long long wakes; /* rings that had to enter the kernel */
+};
+
+/* Read before checking for work, so that a ring in between is not lost */
+extern unsigned int spsc_bell_seq(struct SPSC_BELL *b);
+
+/* Sleep at most 'timeout' (NULL: forever) unless the bell has rung since 'seq' */
+extern void spsc_bell_wait(struct SPSC_BELL *b, unsigned int seq, const struct timespec *timeout);
+
+/* Wake the sleeper, a system call only if there is one */
+extern void spsc_bell_ring(struct SPSC_BELL *b);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,165 @@
+/*
+    Store-and-forward switch of the in-process topology
+
+    A frame is forwarded once its closing delimiter is in, so it leaves
+    the input port whole. The fabric serves frames one at a time at its
+    own rate in arrival order; an output port then sends them at the
+    line rate. Frames are dropped when the fabric or the output port
+    already has more than 'queue' bytes to get through.
+
+    Both servers are FIFO, so the backlog of each is simply the work it
+    has left: when a frame will clear the fabric and the output port is
+    known the moment it arrives. The frame is then written to the peer
+    at once as bytes in flight that land when the output port is done.
+*/
+
+#ifndef _WIN32
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "linecode.h"
+#include "lprintf.h"
+#include "simchan.h"
+#include "switch.h"
+
+struct SW_PORT {
+    unsigned char *unit; /* line bytes of the frame coming in */
+    int len, size;
+    int has_data; /* more than delimiters so far */
+    double free_at; /* ms the output port is done with its queue */
+    unsigned long long frames, bytes, drops;
+    int max_queue; /* bytes */
+};
+
+static struct SW_PORT *sw_port;
+static int sw_n, sw_bps, sw_fabric_bps, sw_queue, sw_linecode, sw_bits;
+static double sw_fabric_free, sw_fabric_wait; /* ms the fabric is busy to, longest wait for it */
+static unsigned long long sw_fabric_drops;
+static pthread_mutex_t sw_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void sw_init(int nport, int bps, int fabric_bps, int queue, int linecode, int line_bits)
+{
+    if ((sw_port = (struct SW_PORT *)calloc(nport, sizeof(struct SW_PORT))) == NULL) {
+        printf("No enough memory\n");
+        exit(0);
+    }
+    sw_n = nport;
+    sw_bps = bps;
+    sw_fabric_bps = fabric_bps;
+    sw_queue = queue;
+    sw_linecode = linecode;
+    sw_bits = line_bits;
+}
+
+/* The frame on 'port' is in at 'now': through the fabric and out of the peer's port */
+static void sw_forward(int port, int now)
+{
+    struct SW_PORT *in = &sw_port[port], *out = &sw_port[port ^ 1];
+    double t = now, bits = (double)in->len * sw_bits, backlog;
+
+    if (sw_fabric_bps) {
+        backlog = sw_fabric_free > t ? (sw_fabric_free - t) * sw_fabric_bps / 1000 / sw_bits : 0;
+        if (backlog + in->len > sw_queue) {
+            sw_fabric_drops++;
+            return;
+        }
+        if (sw_fabric_free > t) {
+            if (sw_fabric_free - t > sw_fabric_wait)
+                sw_fabric_wait = sw_fabric_free - t;
+            t = sw_fabric_free;
+        }
+        t += bits * 1000 / sw_fabric_bps;
+        sw_fabric_free = t;
+    }
+
+    backlog = out->free_at > t ? (out->free_at - t) * sw_bps / 1000 / sw_bits : 0;
+    if (backlog + in->len > sw_queue) {
+        out->drops++;
+        return;
+    }
+    if (backlog + in->len > out->max_queue)
+        out->max_queue = (int)backlog + in->len;
+
+    if (out->free_at > t)
+        t = out->free_at;
+    t += bits * 1000 / sw_bps;
+    out->free_at = t;
+
+    sc_write_at(port ^ 1, in->unit, in->len, (int)ceil(t));
+    out->frames++;
+    out->bytes += in->len;
+}
+
+static void sw_append(struct SW_PORT *p, const unsigned char *buf, int n)
+{
+    unsigned char *grown;
+
+    if (p->len + n > p->size) {
+        p->size = p->size ? p->size * 2 : 4096;
+        while (p->size < p->len + n)
+            p->size *= 2;
+        if ((grown = (unsigned char *)realloc(p->unit, p->size)) == NULL) {
+            printf("No enough memory\n");
+            exit(0);
+        }
+        p->unit = grown;
+    }
+    memcpy(p->unit + p->len, buf, n);
+    p->len += n;
+}
+
+int sw_input(int port, const unsigned char *buf, int n, int now)
+{
+    struct SW_PORT *p = &sw_port[port];
+    int seg, total = n;
+
+    pthread_mutex_lock(&sw_lock);
+    while (n > 0) {
+        seg = lc_find(sw_linecode, buf, n);
+        if (seg > 0)
+            p->has_data = 1;
+        if (seg == n) {
+            sw_append(p, buf, n);
+            break;
+        }
+
+        /* a delimiter closes the frame, unless nothing but delimiters came yet */
+        sw_append(p, buf, seg + 1);
+        if (p->has_data) {
+            sw_forward(port, now);
+            p->len = 0;
+            p->has_data = 0;
+        }
+        buf += seg + 1;
+        n -= seg + 1;
+    }
+    pthread_mutex_unlock(&sw_lock);
+
+    return total;
+}
+
+void sw_report(void)
+{
+    unsigned long long frames = 0, drops = sw_fabric_drops;
+    int i, max_queue = 0;
+
+    pthread_mutex_lock(&sw_lock);
+    for (i = 0; i < sw_n; i++) {
+        frames += sw_port[i].frames;
+        drops += sw_port[i].drops;
+        if (sw_port[i].max_queue > max_queue)
+            max_queue = sw_port[i].max_queue;
+    }
+    lprintf("Switch: %d ports, %llu frames forwarded, %llu dropped, longest output queue %d bytes", sw_n, frames, drops, max_queue);
+    if (sw_fabric_bps)
+        lprintf(", longest fabric wait %.1f ms\n", sw_fabric_wait);
+    else
+        lprintf("\n");
+    pthread_mutex_unlock(&sw_lock);
+}
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef __SWITCH_H__
+#define __SWITCH_H__
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Store-and-forward switch between in-process stations. Every session
+ * end has a port; frames are delimited on the way in, cross a shared
+ * fabric one at a time and wait in the output queue of the peer's port,
+ * which sends them on at the line rate.
+ */
+
+/* 'nport' ports, port 'i' forwarding to port i ^ 1; 'fabric_bps' 0 for a non-blocking fabric */
+extern void sw_init(int nport, int bps, int fabric_bps, int queue, int linecode, int line_bits);
+
+/* Line bytes sent by the station on 'port' at 'now' ms, return the bytes taken */
+extern int sw_input(int port, const unsigned char *buf, int n, int now);
+
+extern void sw_report(void);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,192 @@
+/*
+    Traffic models of the simulated network layer
+
+    A model is an arrival process: tm_arrive() counts the packet due at
+    st->next and draws the time of the one after. Arrivals are open
+    loop, they happen whether or not the datalink keeps up, so the
+    offered load is the model's and not the protocol's.
+
+    trace: one packet per line, "<ms> [<bytes>]", a packet of more than
+           a network-layer packet arriving as that many packets at once.
+*/
+
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "traffic.h"
+
+#ifdef _WIN32
+#define strncasecmp _strnicmp
+#define strcasecmp _stricmp
+#else
+#include <strings.h>
+#endif
+
+#define TM_NEVER 1e300
+
+static int tm_load(struct TM_CONFIG *cfg, const char *fname, int pkt_len)
+{
+    char line[256];
+    double t;
+    int bytes, n, size = 0, *grown;
+    FILE *fp;
+
+    if ((fp = fopen(fname, "r")) == NULL)
+        return -1;
+
+    cfg->ntrace = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        bytes = pkt_len;
+        if (line[0] == '#' || (n = sscanf(line, "%lf %d", &t, &bytes)) < 1)
+            continue;
+        if (t < 0 || t > INT_MAX || bytes <= 0 || (cfg->ntrace && t < cfg->at[cfg->ntrace - 1])) {
+            fclose(fp);
+            return -1;
+        }
+
+        for (n = (bytes + pkt_len - 1) / pkt_len; n > 0; n--) {
+            if (cfg->ntrace == size) {
+                size = size ? size * 2 : 1024;
+                if ((grown = (int *)realloc(cfg->at, size * sizeof(int))) == NULL) {
+                    fclose(fp);
+                    return -1;
+                }
+                cfg->at = grown;
+            }
+            cfg->at[cfg->ntrace++] = (int)t;
+        }
+    }
+    fclose(fp);
+    return cfg->ntrace ? 0 : -1;
+}
+
+int tm_parse(struct TM_CONFIG *cfg, const char *spec, int pkt_len)
+{
+    const char *arg = strchr(spec, ':');
+    int n = arg ? (int)(arg - spec) : (int)strlen(spec);
+
+    if (strcasecmp(spec, "legacy") == 0) {
+        cfg->model = TM_LEGACY;
+        return 0;
+    }
+    if (strcasecmp(spec, "flood") == 0) {
+        cfg->model = TM_FLOOD;
+        return 0;
+    }
+    if (arg == NULL)
+        return -1;
+    arg++;
+
+    if (strncasecmp(spec, "trace", n) == 0 && n == 5) {
+        cfg->model = TM_TRACE;
+        return tm_load(cfg, arg, pkt_len);
+    }
+
+    cfg->on = 1000.0;
+    cfg->alpha = 1.5;
+    if (sscanf(arg, "%lf,%lf,%lf", &cfg->load, &cfg->on, &cfg->alpha) < 1
+        || cfg->load <= 0.0 || cfg->load > 10.0 || cfg->on <= 0.0 || cfg->alpha <= 1.0)
+        return -1;
+
+    if (strncasecmp(spec, "cbr", n) == 0 && n == 3)
+        cfg->model = TM_CBR;
+    else if (strncasecmp(spec, "poisson", n) == 0 && n == 7)
+        cfg->model = TM_POISSON;
+    else if (strncasecmp(spec, "onoff", n) == 0 && n == 5 && cfg->load < 1.0)
+        cfg->model = TM_ONOFF;
+    else
+        return -1;
+    return 0;
+}
+
+/* Pareto variable of shape 'alpha' averaging 'mean' */
+static double tm_pareto(struct TM_STATE *st, double mean)
+{
+    double alpha = st->cfg->alpha;
+
+    return mean * (alpha - 1) / alpha * pow(st->uniform(), -1 / alpha);
+}
+
+void tm_init(struct TM_STATE *st, const struct TM_CONFIG *cfg, double (*uniform)(void), double start)
+{
+    memset(st, 0, sizeof(*st));
+    st->cfg = cfg;
+    st->uniform = uniform;
+    st->next = start;
+
+    switch (cfg->model) {
+    case TM_ONOFF:
+        st->on_end = start + tm_pareto(st, cfg->on);
+        break;
+    case TM_TRACE:
+        st->next = start + cfg->at[0];
+        break;
+    }
+}
+
+void tm_arrive(struct TM_STATE *st, int bps, int bits)
+{
+    const struct TM_CONFIG *cfg = st->cfg;
+    double gap = bits * 1000.0 / bps; /* ms a packet takes at line rate */
+
+    st->offered++;
+    st->offered_bits += bits;
+
+    switch (cfg->model) {
+    case TM_CBR:
+        st->next += gap / cfg->load;
+        break;
+
+    case TM_POISSON:
+        st->next += -log(st->uniform()) * gap / cfg->load;
+        break;
+
+    case TM_ONOFF:
+        /* back to back in a burst, then an OFF period sized for the mean load */
+        st->next += gap;
+        if (st->next >= st->on_end) {
+            st->next = st->on_end + tm_pareto(st, cfg->on * (1 - cfg->load) / cfg->load);
+            st->on_end = st->next + tm_pareto(st, cfg->on);
+        }
+        break;
+
+    case TM_TRACE:
+        if (++st->pos < cfg->ntrace)
+            st->next += cfg->at[st->pos] - cfg->at[st->pos - 1];
+        else
+            st->next = TM_NEVER;
+        break;
+
+    default:
+        st->next += gap;
+        break;
+    }
+}
+
+const char *tm_describe(const struct TM_CONFIG *cfg, char *buf)
+{
+    switch (cfg->model) {
+    case TM_FLOOD:
+        strcpy(buf, "flood");
+        break;
+    case TM_CBR:
+        sprintf(buf, "constant bit rate, %.0f%% load", cfg->load * 100);
+        break;
+    case TM_POISSON:
+        sprintf(buf, "Poisson, %.0f%% load", cfg->load * 100);
+        break;
+    case TM_ONOFF:
+        sprintf(buf, "Pareto on/off, %.0f%% load, %.0f ms bursts, alpha %.2f", cfg->load * 100, cfg->on, cfg->alpha);
+        break;
+    case TM_TRACE:
+        sprintf(buf, "trace, %d packets over %d ms", cfg->ntrace, cfg->at[cfg->ntrace - 1] - cfg->at[0]);
+        break;
+    default:
+        strcpy(buf, "legacy, 3/4 of line rate with BUSY/IDLE periods at station B");
+        break;
+    }
+    return buf;
+}
@@ -0,0 +1,53 @@
+#ifndef __TRAFFIC_H__
+#define __TRAFFIC_H__
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/* Traffic models of the network layer source */
+#define TM_LEGACY  0 /* about 3/4 of line rate, station B alternating BUSY and IDLE periods */
+#define TM_FLOOD   1 /* a packet whenever the datalink takes one */
+#define TM_CBR     2 /* evenly spaced packets at a given load */
+#define TM_POISSON 3 /* exponential gaps averaging a given load */
+#define TM_ONOFF   4 /* bursts at line rate, Pareto ON and OFF periods averaging a given load */
+#define TM_TRACE   5 /* arrival times and sizes read from a file, played once */
+
+struct TM_CONFIG {
+    int model;
+    double load;      /* offered load, fraction of the line rate */
+    double on, alpha; /* TM_ONOFF: mean ON period (ms) and Pareto shape */
+    int *at;          /* TM_TRACE: arrival time (ms) of every packet */
+    int ntrace;
+};
+
+/* Arrival process of one station */
+struct TM_STATE {
+    const struct TM_CONFIG *cfg;
+    double (*uniform)(void); /* random numbers in (0, 1] */
+    double next;             /* ms of the next arrival, an infinite future when done */
+    double on_end;           /* TM_ONOFF: ms the current burst ends */
+    int pos;                 /* TM_TRACE: next line */
+    unsigned long long offered, offered_bits;
+};
+
+/* Parse "legacy", "flood", "cbr:<load>", "poisson:<load>", "onoff:<load>[,<on_ms>[,<alpha>]]" or "trace:<file>" */
+extern int tm_parse(struct TM_CONFIG *cfg, const char *spec, int pkt_len);
+
+/* Start the arrivals at 'start' ms */
+extern void tm_init(struct TM_STATE *st, const struct TM_CONFIG *cfg, double (*uniform)(void), double start);
+
+/*
+ * Count the arrival at st->next and schedule the one after, with 'bps'
+ * the line rate for the load and 'bits' the size of a packet.
+ */
+extern void tm_arrive(struct TM_STATE *st, int bps, int bits);
+
+/* One-line description of the configuration */
+extern const char *tm_describe(const struct TM_CONFIG *cfg, char *buf);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,383 @@
+/*
+    io_uring line between two station processes
+
+    The socket is read by one multishot receive that picks its buffers
+    from a provided buffer ring: every completion names a buffer holding
+    the bytes, which are copied into the receive blocks of the physical
+    layer and the buffer goes straight back to the ring. The receive
+    stays armed across calls, so taking input costs no system call.
+
+    A send writes from the sending queue, registered as a fixed buffer
+    and registered again whenever the queue grows, and carries a linked
+    timeout that bounds how long a full line can hold it. It is
+    submitted together with whatever else is queued (a receive to
+    re-arm, a poll) in the same io_uring_enter() that waits for it.
+    Waiting for input, room or a deadline is one io_uring_enter() too,
+    its timeout passed along.
+
+    System calls go through syscall(2) with <linux/io_uring.h>, so no
+    library is needed.
+*/
+
+#ifndef _WIN32
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "uring.h"
+
+#define UR_ENTRIES 64
+#define UR_NBUF 64 /* provided receive buffers, a power of 2 */
+#define UR_BGID 1
+#define UR_SEND_MS 10 /* a send held longer by a full line gives up, like SO_SNDTIMEO */
+
+/* user_data of the requests */
+#define UD_RECV 1
+#define UD_SEND 2
+#define UD_TIMEOUT 3
+#define UD_POLLOUT 4
+#define UD_KICK 5
+
+static int ur_fd = -1, ur_sock;
+static unsigned int *sq_ktail, *sq_kmask, *sq_karray, *cq_khead, *cq_ktail, *cq_kmask;
+static struct io_uring_sqe *sqes;
+static struct io_uring_cqe *cqes;
+static unsigned int sq_tail, sq_queued; /* sqes written, not submitted yet */
+static unsigned int enters;
+
+static struct io_uring_buf_ring *br;
+static unsigned short br_tail;
+static unsigned char *bufs;
+static int buf_size;
+
+/* received buffers not yet copied out, in order */
+static unsigned short pend_bid[UR_NBUF];
+static int pend_len[UR_NBUF], pend_off;
+static unsigned int pend_head, pend_n;
+
+static unsigned char *fixed;
+static int fixed_size;
+
+static int recv_armed, pollout_armed, kick_armed, kicked, room, gone;
+static int send_res, send_done;
+
+static int ur_enter(unsigned int min, const struct timespec *timeout)
+{
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    unsigned int n = sq_queued, flags = min ? IORING_ENTER_GETEVENTS : 0;
+    int ret;
+
+    sq_queued = 0;
+    enters++;
+    if (timeout) {
+        memset(&arg, 0, sizeof(arg));
+        ts.tv_sec = timeout->tv_sec;
+        ts.tv_nsec = timeout->tv_nsec;
+        arg.ts = (unsigned long long)(unsigned long)&ts;
+        ret = (int)syscall(__NR_io_uring_enter, ur_fd, n, min, flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    } else
+        ret = (int)syscall(__NR_io_uring_enter, ur_fd, n, min, flags, NULL, _NSIG / 8);
+    if (ret < 0 && errno != ETIME && errno != EINTR && errno != EBUSY)
+        return -1;
+    return ret;
+}
+
+static struct io_uring_sqe *ur_sqe(int op, int fd, unsigned long long ud)
+{
+    unsigned int i = sq_tail & *sq_kmask;
+    struct io_uring_sqe *sqe = &sqes[i];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = (unsigned char)op;
+    sqe->fd = fd;
+    sqe->user_data = ud;
+    sq_karray[i] = i;
+    sq_tail++;
+    sq_queued++;
+    __atomic_store_n(sq_ktail, sq_tail, __ATOMIC_RELEASE);
+    return sqe;
+}
+
+/* Give buffer 'bid' back to the kernel; the ring tail overlays resv of the first entry, so fields go one by one */
+static void ur_recycle(unsigned short bid)
+{
+    struct io_uring_buf *b = &br->bufs[br_tail & (UR_NBUF - 1)];
+
+    b->addr = (unsigned long long)(unsigned long)(bufs + (size_t)bid * buf_size);
+    b->len = buf_size;
+    b->bid = bid;
+    br_tail++;
+    __atomic_store_n(&br->tail, br_tail, __ATOMIC_RELEASE);
+}
+
+static void ur_arm_recv(void)
+{
+    struct io_uring_sqe *sqe = ur_sqe(IORING_OP_RECV, ur_sock, UD_RECV);
+
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = UR_BGID;
+    recv_armed = 1;
+}
+
+static void ur_arm_poll(int fd, int events, unsigned long long ud)
+{
+    struct io_uring_sqe *sqe = ur_sqe(IORING_OP_POLL_ADD, fd, ud);
+
+    sqe->poll32_events = events;
+}
+
+static void ur_reap(void)
+{
+    unsigned int head = *cq_khead, tail = __atomic_load_n(cq_ktail, __ATOMIC_ACQUIRE);
+    struct io_uring_cqe *cqe;
+
+    for (; head != tail; head++) {
+        cqe = &cqes[head & *cq_kmask];
+        switch (cqe->user_data) {
+        case UD_RECV:
+            if (!(cqe->flags & IORING_CQE_F_MORE))
+                recv_armed = 0;
+            if (cqe->res > 0) {
+                pend_bid[(pend_head + pend_n) % UR_NBUF] = (unsigned short)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+                pend_len[(pend_head + pend_n) % UR_NBUF] = cqe->res;
+                pend_n++;
+            } else {
+                if (cqe->flags & IORING_CQE_F_BUFFER)
+                    ur_recycle((unsigned short)(cqe->flags >> IORING_CQE_BUFFER_SHIFT));
+                /* out of buffers only pauses the receive, it is re-armed once some come back */
+                if (cqe->res != -ENOBUFS)
+                    gone = 1;
+            }
+            break;
+        case UD_SEND:
+            send_res = cqe->res;
+            send_done = 1;
+            break;
+        case UD_POLLOUT:
+            pollout_armed = 0;
+            room = 1;
+            break;
+        case UD_KICK:
+            kick_armed = 0;
+            kicked = 1;
+            break;
+        }
+    }
+    __atomic_store_n(cq_khead, head, __ATOMIC_RELEASE);
+}
+
+const char *ur_init(int sock, int size)
+{
+    struct io_uring_params p;
+    struct io_uring_buf_reg reg;
+    unsigned char *sq, *cq;
+    size_t sq_len, cq_len;
+    int i;
+
+    memset(&p, 0, sizeof(p));
+    if ((ur_fd = (int)syscall(__NR_io_uring_setup, UR_ENTRIES, &p)) < 0)
+        return strerror(errno);
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG)) {
+        close(ur_fd);
+        return "kernel too old";
+    }
+
+    sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (cq_len > sq_len)
+        sq_len = cq_len;
+    sq = (unsigned char *)mmap(NULL, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ur_fd, IORING_OFF_SQ_RING);
+    sqes = (struct io_uring_sqe *)mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ur_fd, IORING_OFF_SQES);
+    if (sq == MAP_FAILED || sqes == MAP_FAILED) {
+        close(ur_fd);
+        return "mmap() failed";
+    }
+    cq = sq;
+    sq_ktail = (unsigned int *)(sq + p.sq_off.tail);
+    sq_kmask = (unsigned int *)(sq + p.sq_off.ring_mask);
+    sq_karray = (unsigned int *)(sq + p.sq_off.array);
+    cq_khead = (unsigned int *)(cq + p.cq_off.head);
+    cq_ktail = (unsigned int *)(cq + p.cq_off.tail);
+    cq_kmask = (unsigned int *)(cq + p.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    sq_tail = *sq_ktail;
+
+    /* the buffer ring is page aligned, the buffers behind it are not shared with anyone */
+    buf_size = size;
+    if (posix_memalign((void **)&br, 4096, UR_NBUF * sizeof(struct io_uring_buf)) != 0
+        || (bufs = (unsigned char *)malloc((size_t)UR_NBUF * size)) == NULL) {
+        close(ur_fd);
+        return "no memory";
+    }
+    memset(br, 0, UR_NBUF * sizeof(struct io_uring_buf));
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long long)(unsigned long)br;
+    reg.ring_entries = UR_NBUF;
+    reg.bgid = UR_BGID;
+    if (syscall(__NR_io_uring_register, ur_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        close(ur_fd);
+        return "no provided buffer rings";
+    }
+    for (i = 0; i < UR_NBUF; i++)
+        ur_recycle((unsigned short)i);
+
+    /* a fixed-buffer write takes no MSG_NOSIGNAL: a peer gone must come back as -EPIPE, not kill the station */
+    signal(SIGPIPE, SIG_IGN);
+
+    ur_sock = sock;
+    ur_arm_recv();
+    return NULL;
+}
+
+int ur_register(unsigned char *mem, int size)
+{
+    struct iovec iov;
+
+    if (fixed) {
+        syscall(__NR_io_uring_register, ur_fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+        fixed = NULL;
+    }
+    iov.iov_base = mem;
+    iov.iov_len = size;
+    if (syscall(__NR_io_uring_register, ur_fd, IORING_REGISTER_BUFFERS, &iov, 1) < 0)
+        return -1;
+    fixed = mem;
+    fixed_size = size;
+    return 0;
+}
+
+/* One write and the timeout linked to it, submitted and waited for in one call */
+static int ur_send1(const unsigned char *buf, int n)
+{
+    static struct __kernel_timespec limit = { 0, UR_SEND_MS * 1000000L };
+    struct io_uring_sqe *sqe;
+
+    if (fixed && buf >= fixed && buf + n <= fixed + fixed_size) {
+        sqe = ur_sqe(IORING_OP_WRITE_FIXED, ur_sock, UD_SEND);
+        sqe->buf_index = 0;
+    } else {
+        sqe = ur_sqe(IORING_OP_SEND, ur_sock, UD_SEND);
+        sqe->msg_flags = MSG_NOSIGNAL;
+    }
+    sqe->addr = (unsigned long long)(unsigned long)buf;
+    sqe->len = n;
+    sqe->flags = IOSQE_IO_LINK;
+
+    sqe = ur_sqe(IORING_OP_LINK_TIMEOUT, -1, UD_TIMEOUT);
+    sqe->addr = (unsigned long long)(unsigned long)&limit;
+    sqe->len = 1;
+
+    send_done = 0;
+    do {
+        if (ur_enter(1, NULL) < 0)
+            return -1;
+        ur_reap();
+    } while (!send_done);
+    return send_res;
+}
+
+int ur_send(const unsigned char *p1, int n1, const unsigned char *p2, int n2)
+{
+    int ret = ur_send1(p1, n1), ret2;
+
+    /* the second part only once the first is all out, a stream keeps its order */
+    if (ret == n1 && n2 > 0) {
+        ret2 = ur_send1(p2, n2);
+        if (ret2 > 0)
+            ret += ret2;
+    }
+    return ret;
+}
+
+int ur_recv(unsigned char **buf, int nbuf, int size)
+{
+    unsigned short bid;
+    int i = 0, off = 0, n, total = 0;
+
+    ur_reap();
+    while (pend_n && i < nbuf) {
+        bid = pend_bid[pend_head];
+        n = pend_len[pend_head] - pend_off;
+        if (n > size - off)
+            n = size - off;
+        memcpy(buf[i] + off, bufs + (size_t)bid * buf_size + pend_off, n);
+        total += n;
+        off += n;
+        pend_off += n;
+        if (pend_off == pend_len[pend_head]) {
+            ur_recycle(bid);
+            pend_head = (pend_head + 1) % UR_NBUF;
+            pend_n--;
+            pend_off = 0;
+        }
+        if (off == size) {
+            i++;
+            off = 0;
+        }
+    }
+    return total == 0 && gone ? -1 : total;
+}
+
+int ur_wait(const struct timespec *timeout, int want, int kick_fd)
+{
+    unsigned long long v;
+    unsigned int min = 1;
+    int ready;
+
+    ur_reap();
+    if (!recv_armed && !gone && pend_n < UR_NBUF)
+        ur_arm_recv();
+    if ((want & UR_ROOM) && !pollout_armed) {
+        ur_arm_poll(ur_sock, POLLOUT, UD_POLLOUT);
+        pollout_armed = 1;
+    }
+    if (kick_fd >= 0 && !kick_armed) {
+        ur_arm_poll(kick_fd, POLLIN, UD_KICK);
+        kick_armed = 1;
+    }
+
+    ready = ((pend_n || gone) ? UR_INPUT : 0) | (room ? UR_ROOM : 0);
+    if ((ready & want) == 0 && !kicked) {
+        /* input not wanted now: sleep through its completions, each one takes a buffer, so they cannot add up to this */
+        if (!(want & (UR_INPUT | UR_ROOM)) && kick_fd < 0)
+            min = UR_NBUF + 1;
+        if (ur_enter(min, timeout) < 0)
+            return 0;
+        ur_reap();
+    } else if (sq_queued)
+        ur_enter(0, NULL);
+
+    if (kicked) {
+        kicked = 0;
+        if (read(kick_fd, &v, sizeof(v)) < 0)
+            v = 0;
+    }
+
+    ready = (((pend_n || gone) ? UR_INPUT : 0) | (room ? UR_ROOM : 0)) & want;
+    if (ready & UR_ROOM)
+        room = 0;
+    return ready;
+}
+
+unsigned int ur_enters(void)
+{
+    return enters;
+}
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef __URING_H__
+#define __URING_H__
+
+#include <time.h>
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/*
+ * io_uring line over a connected socket: a multishot receive fills a
+ * ring of provided buffers, sends are written from registered memory
+ * under a linked timeout, and one io_uring_enter() submits, waits and
+ * reaps. Needs Linux 6.0 or later.
+ */
+
+/* Set up the ring for 'sock', receive buffers of 'size' bytes; NULL, or why io_uring is not usable */
+extern const char *ur_init(int sock, int size);
+
+/* Send from 'mem' with registered-buffer writes, in place of what was registered before; -1 if the kernel would not pin it */
+extern int ur_register(unsigned char *mem, int size);
+
+/* Write p1[n1] then p2[n2], return bytes taken, <= 0 when the peer is gone or the line stays full */
+extern int ur_send(const unsigned char *p1, int n1, const unsigned char *p2, int n2);
+
+/* Fill 'nbuf' buffers of 'size' bytes in turn, return bytes copied, 0 if none, -1 once the peer is gone */
+extern int ur_recv(unsigned char **buf, int nbuf, int size);
+
+#define UR_INPUT 0x01
+#define UR_ROOM 0x02
+
+/* Sleep at most 'timeout' (NULL: forever) until the wanted UR_INPUT/UR_ROOM or input on 'kick_fd' (-1: none) */
+extern int ur_wait(const struct timespec *timeout, int want, int kick_fd);
+
+/* io_uring_enter() calls so far */
+extern unsigned int ur_enters(void);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
@@ -5,6 +5,9 @@ target("datalink")
     set_kind("binary")
     add_files("src/*.c")
     set_optimize("fastest")
+    if is_plat("linux") then
+        add_syslinks("pthread", "rt", "m")
+    end
 
 --
 -- If you want to known more usage about xmake, please see https://xmake.io